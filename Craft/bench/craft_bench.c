@@ -0,0 +1,572 @@
+// Headless benchmarks for the CPU side of the chunk pipeline.
+// Runs without a window or GL context and writes results as JSON.
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bible.h"
+#include "chunk.h"
+#include "config.h"
+#include "db.h"
+#include "map.h"
+#include "ring.h"
+#include "voxel_text.h"
+#include "world.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#include <psapi.h>
+#define close _close
+#define dup _dup
+#define dup2 _dup2
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#define MAX_RESULTS 64
+#define MIN_ITERATIONS 3
+#define BENCH_BLOCKS 32768
+#define BENCH_CHUNKS 16
+
+static const char *bench_text =
+    "In the beginning God created the heaven and the earth. "
+    "And the earth was without form, and void; and darkness was upon "
+    "the face of the deep. And the Spirit of God moved upon the face "
+    "of the waters.";
+
+typedef struct {
+    const char *name;
+    const char *unit;
+    int skipped;
+    long long iterations;
+    double seconds;
+    double items;
+    long peak_kb;
+} Result;
+
+typedef struct {
+    double min_time;
+    const char *filter;
+    const char *font_path;
+    const char *bible_path;
+    const char *db_path;
+    const char *output_path;
+    int count;
+    Result results[MAX_RESULTS];
+} Bench;
+
+// an operation returns the number of items (blocks, faces, entries) it
+// processed; time spent between bench_pause and bench_resume is excluded
+typedef double (*bench_func)(void *arg);
+
+static double paused_time = 0;
+static double pause_start = 0;
+
+static double now() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+static long peak_memory_kb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(
+        GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return (long)(counters.PeakWorkingSetSize / 1024);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static void bench_pause() {
+    pause_start = now();
+}
+
+static void bench_resume() {
+    paused_time += now() - pause_start;
+}
+
+static int bench_selected(Bench *bench, const char *name) {
+    return !bench->filter || strstr(name, bench->filter);
+}
+
+static Result *bench_result(Bench *bench, const char *name, const char *unit) {
+    Result *result = bench->results + bench->count++;
+    memset(result, 0, sizeof(Result));
+    result->name = name;
+    result->unit = unit;
+    return result;
+}
+
+static void bench_skip(Bench *bench, const char *name, const char *unit) {
+    if (!bench_selected(bench, name) || bench->count == MAX_RESULTS) {
+        return;
+    }
+    bench_result(bench, name, unit)->skipped = 1;
+    fprintf(stderr, "%-28s skipped\n", name);
+}
+
+static void bench_run(
+    Bench *bench, const char *name, const char *unit,
+    bench_func func, void *arg)
+{
+    if (!bench_selected(bench, name) || bench->count == MAX_RESULTS) {
+        return;
+    }
+    Result *result = bench_result(bench, name, unit);
+    func(arg);
+    paused_time = 0;
+    double start = now();
+    double elapsed = 0;
+    while (result->iterations < MIN_ITERATIONS ||
+        elapsed < bench->min_time)
+    {
+        result->items += func(arg);
+        result->iterations++;
+        elapsed = now() - start - paused_time;
+    }
+    result->seconds = elapsed;
+    result->peak_kb = peak_memory_kb();
+    fprintf(stderr, "%-28s %12.0f ns/op %14.0f %s/s\n", name,
+        elapsed * 1e9 / result->iterations,
+        result->items / elapsed, unit);
+}
+
+static int bench_write(Bench *bench) {
+    FILE *file = strcmp(bench->output_path, "-") ?
+        fopen(bench->output_path, "w") : stdout;
+    if (!file) {
+        fprintf(stderr, "Could not write %s\n", bench->output_path);
+        return 0;
+    }
+    fprintf(file, "{\"chunk_size\":%d,\"min_time\":%g,\"benchmarks\":[",
+        CHUNK_SIZE, bench->min_time);
+    for (int i = 0; i < bench->count; i++) {
+        Result *result = bench->results + i;
+        fprintf(file, "%s\n{\"name\":\"%s\",\"unit\":\"%s\"",
+            i ? "," : "", result->name, result->unit);
+        if (result->skipped) {
+            fprintf(file, ",\"skipped\":true}");
+            continue;
+        }
+        fprintf(file,
+            ",\"iterations\":%lld,\"ns_per_op\":%.1f,\"ops_per_sec\":%.1f,"
+            "\"items_per_op\":%.1f,\"items_per_sec\":%.1f,"
+            "\"peak_memory_kb\":%ld}",
+            result->iterations,
+            result->seconds * 1e9 / result->iterations,
+            result->iterations / result->seconds,
+            result->items / result->iterations,
+            result->items / result->seconds,
+            result->peak_kb);
+    }
+    fprintf(file, "\n],\"peak_memory_kb\":%ld}\n", peak_memory_kb());
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 1;
+}
+
+// map
+
+static void chunk_map_alloc(Map *map, int p, int q, int mask) {
+    map_alloc(map,
+        p * CHUNK_SIZE - 1, 0, q * CHUNK_SIZE - 1, mask);
+}
+
+static void map_set_func(int x, int y, int z, int w, void *arg) {
+    map_set((Map *)arg, x, y, z, w);
+}
+
+static int block_x(int i) {
+    return i % CHUNK_SIZE;
+}
+
+static int block_y(int i) {
+    return (i / CHUNK_SIZE / CHUNK_SIZE) % 256;
+}
+
+static int block_z(int i) {
+    return (i / CHUNK_SIZE) % CHUNK_SIZE;
+}
+
+static double bench_map_set(void *arg) {
+    (void)arg;
+    Map map;
+    chunk_map_alloc(&map, 0, 0, 0x7fff);
+    for (int i = 0; i < BENCH_BLOCKS; i++) {
+        map_set(&map, block_x(i), block_y(i), block_z(i), 1 + i % 15);
+    }
+    bench_pause();
+    map_free(&map);
+    bench_resume();
+    return BENCH_BLOCKS;
+}
+
+static double bench_map_get(void *arg) {
+    Map *map = (Map *)arg;
+    int total = 0;
+    for (int i = 0; i < BENCH_BLOCKS; i++) {
+        // every other lookup misses
+        total += map_get(map, block_x(i), block_y(i) * 2, block_z(i));
+    }
+    return total >= 0 ? BENCH_BLOCKS : 0;
+}
+
+static double bench_map_grow(void *arg) {
+    Map *src = (Map *)arg;
+    Map map;
+    bench_pause();
+    map_copy(&map, src);
+    bench_resume();
+    map_grow(&map);
+    bench_pause();
+    map_free(&map);
+    bench_resume();
+    return src->size;
+}
+
+static double bench_map_for_each(void *arg) {
+    Map *map = (Map *)arg;
+    int total = 0;
+    MAP_FOR_EACH(map, ex, ey, ez, ew) {
+        total += ex + ey + ez + ew;
+    } END_MAP_FOR_EACH;
+    return total != 1 ? map->size : 0;
+}
+
+// ring
+
+static double bench_ring(void *arg) {
+    Ring *ring = (Ring *)arg;
+    RingEntry entry;
+    for (int i = 0; i < 4096; i++) {
+        ring_put_block(ring, 0, 0, block_x(i), block_y(i), block_z(i), 1);
+    }
+    while (ring_get(ring, &entry));
+    return 4096;
+}
+
+// world
+
+typedef struct {
+    int flat;
+    int index;
+} WorldArg;
+
+static double bench_create_world(void *arg) {
+    WorldArg *world = (WorldArg *)arg;
+    int p = world->index % BENCH_CHUNKS;
+    int q = world->index / BENCH_CHUNKS % BENCH_CHUNKS;
+    world->index++;
+    Map map;
+    bench_pause();
+    chunk_map_alloc(&map, p, q, 0x7fff);
+    bench_resume();
+    create_terrain(p, q, world->flat, map_set_func, &map);
+    double result = map.size;
+    bench_pause();
+    map_free(&map);
+    bench_resume();
+    return result;
+}
+
+// meshing
+
+typedef struct {
+    Map block_maps[3][3];
+    Map light_maps[3][3];
+    WorkerItem item;
+} ChunkArg;
+
+static Map *text_map = 0;
+
+static void text_block(int x, int y, int z, int w) {
+    int p = (x - text_map->dx - 1) / CHUNK_SIZE;
+    int q = (z - text_map->dz - 1) / CHUNK_SIZE;
+    if (p == 0 && q == 0) {
+        map_set(text_map, x, y, z, w);
+    }
+}
+
+static void chunk_arg_alloc(ChunkArg *chunk, int flat, int text, int lit) {
+    WorkerItem *item = &chunk->item;
+    memset(item, 0, sizeof(WorkerItem));
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            int p = a - 1;
+            int q = b - 1;
+            Map *block_map = &chunk->block_maps[a][b];
+            Map *light_map = &chunk->light_maps[a][b];
+            chunk_map_alloc(block_map, p, q, 0x7fff);
+            chunk_map_alloc(light_map, p, q, 0xf);
+            create_terrain(p, q, flat, map_set_func, block_map);
+            item->block_maps[a][b] = block_map;
+            item->light_maps[a][b] = light_map;
+        }
+    }
+    Map *center = &chunk->block_maps[1][1];
+    if (text) {
+        text_map = center;
+        voxel_text_render_flat(
+            bench_text, 0, FLATLANDS_HEIGHT + 1, 0, 3, 4, 2, text_block);
+    }
+    if (lit) {
+        Map *lights = &chunk->light_maps[1][1];
+        for (int x = 2; x < CHUNK_SIZE; x += 8) {
+            for (int z = 2; z < CHUNK_SIZE; z += 8) {
+                map_set(lights, x, FLATLANDS_HEIGHT + 1, z, 15);
+            }
+        }
+    }
+}
+
+static void chunk_arg_free(ChunkArg *chunk) {
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            map_free(&chunk->block_maps[a][b]);
+            map_free(&chunk->light_maps[a][b]);
+        }
+    }
+}
+
+static double bench_compute_chunk(void *arg) {
+    WorkerItem *item = &((ChunkArg *)arg)->item;
+    compute_chunk(item);
+    bench_pause();
+    free(item->data);
+    bench_resume();
+    return item->faces;
+}
+
+// text
+
+static int text_blocks = 0;
+
+static void count_block(int x, int y, int z, int w) {
+    (void)x; (void)y; (void)z; (void)w;
+    text_blocks++;
+}
+
+static double bench_voxel_text(void *arg) {
+    (void)arg;
+    text_blocks = 0;
+    voxel_text_render_flat(bench_text, 0, 100, 0, 3, 40, 2, count_block);
+    return text_blocks;
+}
+
+static double bench_bible_lookup(void *arg) {
+    (void)arg;
+    static const char *books[] = {
+        "Genesis", "Psalms", "Isaiah", "Matthew", "John", "Revelation"
+    };
+    char text[1024];
+    int found = 0;
+    for (int i = 0; i < 64; i++) {
+        found += bible_get_verse_text(
+            books[i % 6], 1 + i % 5, 1 + i % 20, text, sizeof(text));
+    }
+    return found;
+}
+
+// database
+
+static double bench_db_load_blocks(void *arg) {
+    int *index = (int *)arg;
+    int p = *index % BENCH_CHUNKS;
+    int q = *index / BENCH_CHUNKS % BENCH_CHUNKS;
+    (*index)++;
+    Map map;
+    bench_pause();
+    chunk_map_alloc(&map, p, q, 0x7fff);
+    bench_resume();
+    db_load_blocks(&map, p, q);
+    double result = map.size;
+    bench_pause();
+    map_free(&map);
+    bench_resume();
+    return result;
+}
+
+static int generate_database(const char *path) {
+    remove(path);
+    db_enable();
+    if (db_init((char *)path)) {
+        fprintf(stderr, "Could not create %s\n", path);
+        db_disable();
+        return 0;
+    }
+    // one chunk row per block, the shape of a heavily edited world
+    for (int p = 0; p < BENCH_CHUNKS; p++) {
+        for (int q = 0; q < BENCH_CHUNKS; q++) {
+            for (int i = 0; i < 2048; i++) {
+                db_insert_block(p, q,
+                    p * CHUNK_SIZE + block_x(i), 32 + block_y(i),
+                    q * CHUNK_SIZE + block_z(i), 1 + i % 15);
+            }
+        }
+    }
+    db_close();
+    if (db_init((char *)path)) {
+        db_disable();
+        return 0;
+    }
+    return 1;
+}
+
+// main
+
+static void run_all(Bench *bench) {
+    Map terrain;
+    chunk_map_alloc(&terrain, 0, 0, 0x7fff);
+    create_terrain(0, 0, 0, map_set_func, &terrain);
+    bench_run(bench, "map_set", "blocks", bench_map_set, 0);
+    bench_run(bench, "map_get", "lookups", bench_map_get, &terrain);
+    bench_run(bench, "map_grow", "entries", bench_map_grow, &terrain);
+    bench_run(bench, "map_for_each", "entries",
+        bench_map_for_each, &terrain);
+    map_free(&terrain);
+
+    Ring ring;
+    ring_alloc(&ring, 1024);
+    bench_run(bench, "ring_put_get", "entries", bench_ring, &ring);
+    ring_free(&ring);
+
+    WorldArg flat = {1, 0};
+    WorldArg noise = {0, 0};
+    bench_run(bench, "create_world_flat", "blocks",
+        bench_create_world, &flat);
+    bench_run(bench, "create_world_noise", "blocks",
+        bench_create_world, &noise);
+
+    int has_font = voxel_text_init(bench->font_path);
+    ChunkArg *chunk = malloc(sizeof(ChunkArg));
+    chunk_arg_alloc(chunk, 0, 0, 0);
+    bench_run(bench, "compute_chunk_terrain", "faces",
+        bench_compute_chunk, chunk);
+    chunk_arg_free(chunk);
+    if (has_font) {
+        chunk_arg_alloc(chunk, 1, 1, 0);
+        bench_run(bench, "compute_chunk_text", "faces",
+            bench_compute_chunk, chunk);
+        chunk_arg_free(chunk);
+    }
+    else {
+        bench_skip(bench, "compute_chunk_text", "faces");
+    }
+    chunk_arg_alloc(chunk, 1, 0, 1);
+    bench_run(bench, "compute_chunk_lit", "faces",
+        bench_compute_chunk, chunk);
+    chunk_arg_free(chunk);
+    free(chunk);
+
+    if (has_font) {
+        bench_run(bench, "voxel_text_render_flat", "blocks",
+            bench_voxel_text, 0);
+        voxel_text_cleanup();
+    }
+    else {
+        bench_skip(bench, "voxel_text_render_flat", "blocks");
+    }
+
+    if (bible_init(bench->bible_path)) {
+        bench_run(bench, "bible_verse_lookup", "verses",
+            bench_bible_lookup, 0);
+        bible_cleanup();
+    }
+    else {
+        bench_skip(bench, "bible_verse_lookup", "verses");
+    }
+
+    if (bench_selected(bench, "db_load_blocks")) {
+        if (generate_database(bench->db_path)) {
+            int index = 0;
+            bench_run(bench, "db_load_blocks", "blocks",
+                bench_db_load_blocks, &index);
+            db_close();
+            db_disable();
+            remove(bench->db_path);
+        }
+        else {
+            bench_skip(bench, "db_load_blocks", "blocks");
+        }
+    }
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: craft_bench [--filter NAME] [--time SECONDS] "
+        "[--output FILE] [--font FILE] [--bible FILE] [--db FILE]\n");
+}
+
+int main(int argc, char **argv) {
+    static Bench bench;
+    bench.min_time = 0.5;
+    bench.filter = 0;
+    bench.font_path = "../Fonts/unifont-17.0.03.hex";
+    bench.bible_path = "../Bible/kjv.txt";
+    bench.db_path = "craft-bench.db";
+    bench.output_path = "-";
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc) {
+            usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "--filter") == 0) {
+            bench.filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--time") == 0) {
+            bench.min_time = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--output") == 0) {
+            bench.output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--font") == 0) {
+            bench.font_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bible") == 0) {
+            bench.bible_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--db") == 0) {
+            bench.db_path = argv[++i];
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    // the modules under test report progress on stdout, send that to
+    // stderr so the JSON can be piped
+    fflush(stdout);
+    int saved = dup(1);
+    dup2(2, 1);
+    run_all(&bench);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    return bench_write(&bench) ? 0 : 1;
+}
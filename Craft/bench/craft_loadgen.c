@@ -0,0 +1,581 @@
+// Load generator for the multiplayer server. Connects a number of
+// simulated players to a local server through the game's own client code,
+// walks them along scripted paths while they ask for chunks, build and
+// report their positions, and writes throughput and latency as JSON.
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "client.h"
+#include "packet.h"
+#include "tinycthread.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define MAX_BOTS 1024
+#define MAX_PENDING 4096
+#define MAX_REQUESTED 16384
+#define MAX_SAMPLES 65536
+#define PROBE_KEY 2147483647
+#define BUILD_HEIGHT 200
+#define BUILD_ITEM 1
+#define PI 3.14159265359
+
+#define PATH_LINE 0
+#define PATH_CIRCLE 1
+
+typedef struct {
+    const char *host;
+    int port;
+    int bots;
+    double duration;
+    double drain;
+    double position_rate;
+    double block_rate;
+    double probe_rate;
+    double speed;
+    double radius;
+    int chunk_radius;
+    int path;
+    int binary;
+    const char *output_path;
+} Options;
+
+typedef struct {
+    int p;
+    int q;
+    int probe;
+    double time;
+} Request;
+
+typedef struct {
+    int p;
+    int q;
+} Chunk;
+
+typedef struct {
+    double *data;
+    int count;
+} Samples;
+
+typedef struct {
+    int index;
+    thrd_t thread;
+    Client *connection;
+    int connected;
+    int dropped;
+    int binary;
+    float x;
+    float z;
+    float angle;
+    int p;
+    int q;
+    int has_block;
+    int block[3];
+    Request pending[MAX_PENDING];
+    int pending_start;
+    int pending_count;
+    int max_pending;
+    Chunk requested[MAX_REQUESTED];
+    int requested_count;
+    int chunks_answered;
+    Samples chunk_latency;
+    Samples probe_latency;
+    long long messages_sent;
+    long long messages_received;
+    int bytes_sent;
+    int bytes_received;
+} Bot;
+
+static Options options;
+
+static double now() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+static void bot_sleep() {
+    struct timespec ts = {0, 1000000};
+    thrd_sleep(&ts, 0);
+}
+
+static int chunked(float x) {
+    return (int)floorf(roundf(x) / 32);
+}
+
+static void samples_add(Samples *samples, double value) {
+    if (samples->count < MAX_SAMPLES) {
+        samples->data[samples->count++] = value;
+    }
+}
+
+static int compare_samples(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(Samples *samples, double fraction) {
+    if (!samples->count) {
+        return 0;
+    }
+    return samples->data[(int)(fraction * (samples->count - 1))];
+}
+
+// Bots start spread out around the spawn point. Lines walk straight
+// away from it, so every bot keeps asking for chunks it has not seen;
+// circles stay on the same ring of chunks and mostly send positions.
+static void bot_move(Bot *bot, double elapsed) {
+    float a = bot->angle;
+    if (options.path == PATH_CIRCLE) {
+        a += elapsed * options.speed / options.radius;
+        bot->x = cosf(a) * options.radius;
+        bot->z = sinf(a) * options.radius;
+    }
+    else {
+        float d = options.radius + elapsed * options.speed;
+        bot->x = cosf(a) * d;
+        bot->z = sinf(a) * d;
+    }
+}
+
+static int bot_requested(Bot *bot, int p, int q) {
+    for (int i = 0; i < bot->requested_count; i++) {
+        if (bot->requested[i].p == p && bot->requested[i].q == q) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int bot_push(Bot *bot, int p, int q, int probe) {
+    if (bot->pending_count == MAX_PENDING) {
+        return 0;
+    }
+    int index = (bot->pending_start + bot->pending_count) % MAX_PENDING;
+    Request *request = bot->pending + index;
+    request->p = p;
+    request->q = q;
+    request->probe = probe;
+    request->time = now();
+    bot->pending_count++;
+    if (bot->pending_count > bot->max_pending) {
+        bot->max_pending = bot->pending_count;
+    }
+    return 1;
+}
+
+// The server answers requests from one connection in order, so the
+// answer normally belongs to the oldest request.
+static void bot_answer(Bot *bot, int p, int q) {
+    for (int i = 0; i < bot->pending_count; i++) {
+        int index = (bot->pending_start + i) % MAX_PENDING;
+        Request *request = bot->pending + index;
+        if (request->p != p || request->q != q) {
+            continue;
+        }
+        double latency = now() - request->time;
+        if (request->probe) {
+            samples_add(&bot->probe_latency, latency);
+        }
+        else {
+            samples_add(&bot->chunk_latency, latency);
+            bot->chunks_answered++;
+        }
+        for (int j = i; j > 0; j--) {
+            bot->pending[(bot->pending_start + j) % MAX_PENDING] =
+                bot->pending[(bot->pending_start + j - 1) % MAX_PENDING];
+        }
+        bot->pending_start = (bot->pending_start + 1) % MAX_PENDING;
+        bot->pending_count--;
+        return;
+    }
+}
+
+static void bot_request_chunks(Bot *bot) {
+    int data[MAX_PENDING * 3];
+    int count = 0;
+    int r = options.chunk_radius;
+    for (int dp = -r; dp <= r; dp++) {
+        for (int dq = -r; dq <= r; dq++) {
+            int p = bot->p + dp;
+            int q = bot->q + dq;
+            if (bot->requested_count == MAX_REQUESTED) {
+                break;
+            }
+            if (bot_requested(bot, p, q) || !bot_push(bot, p, q, 0)) {
+                continue;
+            }
+            bot->requested[bot->requested_count].p = p;
+            bot->requested[bot->requested_count].q = q;
+            bot->requested_count++;
+            data[count * 3 + 0] = p;
+            data[count * 3 + 1] = q;
+            data[count * 3 + 2] = 0;
+            count++;
+        }
+    }
+    client_chunks(data, count);
+    bot->messages_sent += count;
+}
+
+// Alternately places a block high above the bot and takes it away again,
+// so every edit is accepted and goes out to the players nearby.
+static void bot_build(Bot *bot) {
+    if (bot->has_block) {
+        client_block(bot->block[0], bot->block[1], bot->block[2], 0);
+        bot->has_block = 0;
+    }
+    else {
+        bot->block[0] = (int)roundf(bot->x);
+        bot->block[1] = BUILD_HEIGHT + bot->index % 32;
+        bot->block[2] = (int)roundf(bot->z);
+        client_block(bot->block[0], bot->block[1], bot->block[2], BUILD_ITEM);
+        bot->has_block = 1;
+    }
+    bot->messages_sent++;
+}
+
+static void bot_receive(Bot *bot) {
+    while (get_client_enabled()) {
+        int p, q;
+        if (!bot->binary) {
+            char *line = client_recv_line();
+            if (!line) {
+                break;
+            }
+            bot->messages_received++;
+            if (strcmp(line, "V,2") == 0) {
+                client_enable_binary();
+                bot->binary = 1;
+            }
+            else if (sscanf(line, "C,%d,%d", &p, &q) == 2) {
+                bot_answer(bot, p, q);
+            }
+            continue;
+        }
+        int length;
+        char *data = client_recv_packet(&length);
+        if (!data) {
+            break;
+        }
+        bot->messages_received++;
+        if (data[0] == 'C' || data[0] == 'Z') {
+            Packet packet;
+            packet_init(&packet, data + 1, length - 1);
+            p = packet_int(&packet);
+            q = packet_int(&packet);
+            if (!packet.error) {
+                bot_answer(bot, p, q);
+            }
+        }
+    }
+}
+
+static int bot_run(void *arg) {
+    Bot *bot = (Bot *)arg;
+    client_select(bot->connection);
+    client_enable();
+    if (client_connect((char *)options.host, options.port) ||
+        client_start())
+    {
+        return 0;
+    }
+    bot->connected = 1;
+    client_version(1);
+    if (options.binary) {
+        client_version(2);
+    }
+    client_version(3);
+    client_login("", "");
+    bot->messages_sent += 3 + options.binary;
+    double start = now();
+    double end = start + options.duration;
+    double next_position = start;
+    double next_block = start;
+    double next_probe = start;
+    bot->p = bot->q = 0x7fffffff;
+    while (get_client_enabled()) {
+        double t = now();
+        if (t >= end) {
+            break;
+        }
+        bot_receive(bot);
+        bot_move(bot, t - start);
+        int p = chunked(bot->x);
+        int q = chunked(bot->z);
+        if (p != bot->p || q != bot->q) {
+            bot->p = p;
+            bot->q = q;
+            bot_request_chunks(bot);
+        }
+        if (options.position_rate > 0 && t >= next_position) {
+            client_position(bot->x, BUILD_HEIGHT, bot->z, bot->angle, 0);
+            bot->messages_sent++;
+            next_position += 1 / options.position_rate;
+        }
+        if (options.block_rate > 0 && t >= next_block) {
+            bot_build(bot);
+            next_block += 1 / options.block_rate;
+        }
+        if (options.probe_rate > 0 && t >= next_probe) {
+            // asks for nothing newer than the last block, so the answer
+            // is a bare C and its delay is time spent queued on the server
+            if (bot_push(bot, bot->p, bot->q, 1)) {
+                client_chunk(bot->p, bot->q, PROBE_KEY);
+                bot->messages_sent++;
+            }
+            next_probe += 1 / options.probe_rate;
+        }
+        bot_sleep();
+    }
+    if (bot->has_block) {
+        bot_build(bot);
+    }
+    // give the server a moment to answer what is still outstanding
+    end = now() + options.drain;
+    while (get_client_enabled() && bot->pending_count && now() < end) {
+        bot_receive(bot);
+        bot_sleep();
+    }
+    bot->dropped = !get_client_enabled();
+    get_client_bytes(&bot->bytes_sent, &bot->bytes_received);
+    client_stop();
+    client_disable();
+    return 0;
+}
+
+static void write_latency(FILE *file, Samples *samples) {
+    qsort(samples->data, samples->count, sizeof(double), compare_samples);
+    fprintf(file,
+        "\"samples\": %d, \"p50_ms\": %.3f, \"p90_ms\": %.3f, "
+        "\"p99_ms\": %.3f, \"max_ms\": %.3f",
+        samples->count,
+        percentile(samples, 0.5) * 1000,
+        percentile(samples, 0.9) * 1000,
+        percentile(samples, 0.99) * 1000,
+        percentile(samples, 1) * 1000);
+}
+
+static int write_report(Bot *bots, double elapsed) {
+    FILE *file = stdout;
+    if (strcmp(options.output_path, "-") != 0) {
+        file = fopen(options.output_path, "w");
+        if (!file) {
+            perror(options.output_path);
+            return 0;
+        }
+    }
+    Samples chunk_latency = {0};
+    Samples probe_latency = {0};
+    chunk_latency.data = malloc(sizeof(double) * MAX_SAMPLES);
+    probe_latency.data = malloc(sizeof(double) * MAX_SAMPLES);
+    int connected = 0;
+    int dropped = 0;
+    int requested = 0;
+    int answered = 0;
+    int unanswered = 0;
+    int max_pending = 0;
+    long long messages_sent = 0;
+    long long messages_received = 0;
+    long long bytes_sent = 0;
+    long long bytes_received = 0;
+    for (int i = 0; i < options.bots; i++) {
+        Bot *bot = bots + i;
+        connected += bot->connected;
+        dropped += bot->dropped;
+        requested += bot->requested_count;
+        answered += bot->chunks_answered;
+        unanswered += bot->pending_count;
+        if (bot->max_pending > max_pending) {
+            max_pending = bot->max_pending;
+        }
+        messages_sent += bot->messages_sent;
+        messages_received += bot->messages_received;
+        bytes_sent += bot->bytes_sent;
+        bytes_received += bot->bytes_received;
+        for (int j = 0; j < bot->chunk_latency.count; j++) {
+            samples_add(&chunk_latency, bot->chunk_latency.data[j]);
+        }
+        for (int j = 0; j < bot->probe_latency.count; j++) {
+            samples_add(&probe_latency, bot->probe_latency.data[j]);
+        }
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"host\": \"%s\",\n", options.host);
+    fprintf(file, "  \"port\": %d,\n", options.port);
+    fprintf(file, "  \"protocol\": \"%s\",\n",
+        options.binary ? "binary" : "text");
+    fprintf(file, "  \"path\": \"%s\",\n",
+        options.path == PATH_CIRCLE ? "circle" : "line");
+    fprintf(file, "  \"bots\": %d,\n", options.bots);
+    fprintf(file, "  \"connected\": %d,\n", connected);
+    fprintf(file, "  \"dropped\": %d,\n", dropped);
+    fprintf(file, "  \"seconds\": %.3f,\n", elapsed);
+    fprintf(file, "  \"messages_sent\": %lld,\n", messages_sent);
+    fprintf(file, "  \"messages_received\": %lld,\n", messages_received);
+    fprintf(file, "  \"sent_per_second\": %.1f,\n",
+        messages_sent / elapsed);
+    fprintf(file, "  \"received_per_second\": %.1f,\n",
+        messages_received / elapsed);
+    fprintf(file, "  \"bytes_sent\": %lld,\n", bytes_sent);
+    fprintf(file, "  \"bytes_received\": %lld,\n", bytes_received);
+    fprintf(file, "  \"chunks\": {\"requested\": %d, \"answered\": %d, ",
+        requested, answered);
+    write_latency(file, &chunk_latency);
+    fprintf(file, "},\n");
+    fprintf(file, "  \"backlog\": {\"max_pending\": %d, "
+        "\"unanswered\": %d, ", max_pending, unanswered);
+    write_latency(file, &probe_latency);
+    fprintf(file, "}\n");
+    fprintf(file, "}\n");
+    free(chunk_latency.data);
+    free(probe_latency.data);
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 1;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: craft_loadgen [--host HOST] [--port PORT] [--bots N] "
+        "[--time SECONDS]\n"
+        "    [--drain SECONDS] [--position-rate HZ] [--block-rate HZ] "
+        "[--probe-rate HZ]\n"
+        "    [--speed BLOCKS] [--radius BLOCKS] [--chunk-radius CHUNKS] "
+        "[--path line|circle]\n"
+        "    [--protocol binary|text] [--output FILE]\n");
+}
+
+int main(int argc, char **argv) {
+    options.host = "localhost";
+    options.port = DEFAULT_PORT;
+    options.bots = 16;
+    options.duration = 30;
+    options.drain = 5;
+    options.position_rate = 10;
+    options.block_rate = 1;
+    options.probe_rate = 1;
+    options.speed = 8;
+    options.radius = 64;
+    options.chunk_radius = 4;
+    options.path = PATH_LINE;
+    options.binary = 1;
+    options.output_path = "-";
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc) {
+            usage();
+            return 1;
+        }
+        const char *arg = argv[i];
+        const char *value = argv[++i];
+        if (strcmp(arg, "--host") == 0) {
+            options.host = value;
+        }
+        else if (strcmp(arg, "--port") == 0) {
+            options.port = atoi(value);
+        }
+        else if (strcmp(arg, "--bots") == 0) {
+            options.bots = atoi(value);
+        }
+        else if (strcmp(arg, "--time") == 0) {
+            options.duration = atof(value);
+        }
+        else if (strcmp(arg, "--drain") == 0) {
+            options.drain = atof(value);
+        }
+        else if (strcmp(arg, "--position-rate") == 0) {
+            options.position_rate = atof(value);
+        }
+        else if (strcmp(arg, "--block-rate") == 0) {
+            options.block_rate = atof(value);
+        }
+        else if (strcmp(arg, "--probe-rate") == 0) {
+            options.probe_rate = atof(value);
+        }
+        else if (strcmp(arg, "--speed") == 0) {
+            options.speed = atof(value);
+        }
+        else if (strcmp(arg, "--radius") == 0) {
+            options.radius = atof(value);
+        }
+        else if (strcmp(arg, "--chunk-radius") == 0) {
+            options.chunk_radius = atoi(value);
+        }
+        else if (strcmp(arg, "--path") == 0 && strcmp(value, "line") == 0) {
+            options.path = PATH_LINE;
+        }
+        else if (strcmp(arg, "--path") == 0 && strcmp(value, "circle") == 0) {
+            options.path = PATH_CIRCLE;
+        }
+        else if (strcmp(arg, "--protocol") == 0 &&
+            strcmp(value, "binary") == 0)
+        {
+            options.binary = 1;
+        }
+        else if (strcmp(arg, "--protocol") == 0 &&
+            strcmp(value, "text") == 0)
+        {
+            options.binary = 0;
+        }
+        else if (strcmp(arg, "--output") == 0) {
+            options.output_path = value;
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (options.bots < 1 || options.bots > MAX_BOTS ||
+        options.duration <= 0 || options.radius <= 0 ||
+        options.chunk_radius < 0)
+    {
+        usage();
+        return 1;
+    }
+    Bot *bots = calloc(options.bots, sizeof(Bot));
+    for (int i = 0; i < options.bots; i++) {
+        Bot *bot = bots + i;
+        bot->index = i;
+        bot->angle = 2 * PI * i / options.bots;
+        bot->connection = client_create();
+        bot->chunk_latency.data = malloc(sizeof(double) * MAX_SAMPLES);
+        bot->probe_latency.data = malloc(sizeof(double) * MAX_SAMPLES);
+    }
+    double start = now();
+    for (int i = 0; i < options.bots; i++) {
+        if (thrd_create(&bots[i].thread, bot_run, bots + i) != thrd_success) {
+            perror("thrd_create");
+            return 1;
+        }
+    }
+    for (int i = 0; i < options.bots; i++) {
+        thrd_join(bots[i].thread, 0);
+    }
+    double elapsed = now() - start;
+    int result = write_report(bots, elapsed);
+    for (int i = 0; i < options.bots; i++) {
+        client_destroy(bots[i].connection);
+        free(bots[i].chunk_latency.data);
+        free(bots[i].probe_latency.data);
+    }
+    free(bots);
+    return result ? 0 : 1;
+}
@@ -1,3 +1,4 @@
+from bisect import bisect_left
 from math import floor
 from world import World
 import queue as Queue
@@ -7,10 +8,12 @@ import random
 import re
 import requests
 import sqlite3
+import struct
 import sys
 import threading
 import time
 import traceback
+import zlib
 
 DEFAULT_HOST = '0.0.0.0'
 DEFAULT_PORT = 4080
@@ -21,6 +24,12 @@ LOG_PATH = 'log.txt'
 CHUNK_SIZE = 32
 BUFFER_SIZE = 4096
 COMMIT_INTERVAL = 5
+TICK_INTERVAL = 0.05
+INTEREST_RADIUS = 8
+POSITION_DELAY = 0.1
+BINARY_PROTOCOL = True
+BATCH_SIZE = 4096
+SNAPSHOT_SIZE = 256
 
 AUTH_REQUIRED = True
 AUTH_URL = 'https://craft.michaelfogleman.com/api/1/access'
@@ -46,6 +55,7 @@ NICK = 'N'
 POSITION = 'P'
 REDRAW = 'R'
 SIGN = 'S'
+SNAPSHOT = 'Z'
 TALK = 'T'
 TIME = 'E'
 VERSION = 'V'
@@ -69,6 +79,108 @@ def chunked(x):
 def packet(*args):
     return '%s\n' % ','.join(map(str, args))
 
+# Version 2 clients get binary packets: a varint length, the command byte
+# and the fields. Signed integers are zigzag varints, floats little-endian.
+# Coordinates are relative to the chunk and the blocks and lights of a
+# chunk are sent in runs of up to BATCH_SIZE.
+
+def varint(n):
+    result = bytearray()
+    while n > 0x7f:
+        result.append((n & 0x7f) | 0x80)
+        n >>= 7
+    result.append(n)
+    return bytes(result)
+
+def zigzag(n):
+    return varint(n << 1 if n >= 0 else (-n << 1) - 1)
+
+def string(text):
+    data = str(text).encode('utf-8')
+    return varint(len(data)) + data
+
+def frame(command, *fields):
+    data = command.encode('ascii') + b''.join(fields)
+    return varint(len(data)) + data
+
+def block_frame(command, p, q, blocks):
+    dx, dz = p * CHUNK_SIZE, q * CHUNK_SIZE
+    fields = [zigzag(p), zigzag(q), varint(len(blocks))]
+    for x, y, z, w in blocks:
+        fields.append(zigzag(x - dx) + zigzag(y) + zigzag(z - dz) + zigzag(w))
+    return frame(command, *fields)
+
+# A snapshot carries a chunk's blocks, lights and signs in one zlib stream.
+# Blocks and lights are runs over the cells of the chunk and its border,
+# indexed by y, then z, then x: cells skipped, run length and value.
+
+SNAPSHOT_WIDTH = CHUNK_SIZE + 2
+SNAPSHOT_HEIGHT = 256
+
+def snapshot_index(p, q, x, y, z):
+    x -= p * CHUNK_SIZE - 1
+    z -= q * CHUNK_SIZE - 1
+    if not (0 <= x < SNAPSHOT_WIDTH and 0 <= z < SNAPSHOT_WIDTH and
+            0 <= y < SNAPSHOT_HEIGHT):
+        return None
+    return (y * SNAPSHOT_WIDTH + z) * SNAPSHOT_WIDTH + x
+
+def snapshot_runs(cells):
+    runs = []
+    end = 0
+    for index, w in sorted(cells.items()):
+        if runs and index == end and w == runs[-1][2]:
+            runs[-1][1] += 1
+        else:
+            runs.append([index - end, 1, w])
+        end = index + 1
+    fields = [varint(len(runs))]
+    for skip, length, w in runs:
+        fields.append(varint(skip) + varint(length) + zigzag(w))
+    return b''.join(fields)
+
+def snapshot_frame(p, q, key, blocks, lights, signs):
+    fields = []
+    for cells in (blocks, lights):
+        fields.append(snapshot_runs(cells))
+    fields.append(varint(len(signs)))
+    for x, y, z, face, text in signs:
+        fields.append(zigzag(x - p * CHUNK_SIZE) + zigzag(y) +
+            zigzag(z - q * CHUNK_SIZE) + varint(face) + string(text))
+    data = b''.join(fields)
+    return frame(SNAPSHOT, zigzag(p), zigzag(q), varint(key),
+        varint(len(data)), zlib.compress(data))
+
+def binary_packet(command, *args):
+    if command in (BLOCK, LIGHT):
+        p, q, x, y, z, w = map(int, args)
+        return block_frame(command, p, q, [(x, y, z, w)])
+    if command in (YOU, POSITION):
+        pid, x, y, z, rx, ry = args
+        return frame(command, varint(pid), struct.pack('<5f', x, y, z, rx, ry))
+    if command == SIGN:
+        p, q, x, y, z, face, text = args
+        return frame(command, zigzag(p), zigzag(q),
+            zigzag(x - p * CHUNK_SIZE), zigzag(y), zigzag(z - q * CHUNK_SIZE),
+            varint(face), string(text))
+    if command == KEY:
+        p, q, key = args
+        return frame(command, zigzag(p), zigzag(q), varint(key))
+    if command in (REDRAW, CHUNK):
+        p, q = args
+        return frame(command, zigzag(p), zigzag(q))
+    if command == TIME:
+        elapsed, day_length = args
+        return frame(command, struct.pack('<d', elapsed), varint(day_length))
+    if command == DISCONNECT:
+        return frame(command, varint(args[0]))
+    if command == NICK:
+        pid, nick = args
+        return frame(command, varint(pid), string(nick))
+    if command == TALK:
+        return frame(command, string(args[0]))
+    raise ValueError(command)
+
 class RateLimiter(object):
     def __init__(self, rate, per):
         self.rate = float(rate)
@@ -93,15 +205,22 @@ class RateLimiter(object):
 class Server(SocketServer.ThreadingMixIn, SocketServer.TCPServer):
     allow_reuse_address = True
     daemon_threads = True
+    request_queue_size = 128
 
 class Handler(SocketServer.BaseRequestHandler):
     def setup(self):
         self.position_limiter = RateLimiter(100, 5)
         self.limiter = RateLimiter(1000, 10)
         self.version = None
+        self.binary = False
+        self.padding = True
         self.client_id = None
         self.user_id = None
         self.nick = None
+        self.cell = None
+        self.visible = set()
+        self.sent = {}
+        self.pending = set()
         self.queue = Queue.Queue()
         self.running = True
         self.start()
@@ -155,22 +274,51 @@ class Handler(SocketServer.BaseRequestHandler):
                         pass
                 except Queue.Empty:
                     continue
-                data = ''.join(buf).encode('utf-8')
-                self.request.sendall(data)
+                self.request.sendall(b''.join(buf))
             except Exception:
                 self.request.close()
                 raise
+    def encode(self, *args):
+        if self.binary:
+            return binary_packet(*args)
+        return packet(*args).encode('utf-8')
+    def encode_blocks(self, command, p, q, blocks):
+        if self.binary:
+            return b''.join(
+                block_frame(command, p, q, blocks[i:i + BATCH_SIZE])
+                for i in range(0, len(blocks), BATCH_SIZE))
+        return ''.join(
+            packet(command, p, q, *block) for block in blocks).encode('utf-8')
+    def encode_snapshot(self, p, q, key, blocks, lights, signs):
+        # cells outside the snapshot go out as plain runs ahead of it
+        cells = [{}, {}]
+        rest = [[], []]
+        for i, rows in enumerate((blocks, lights)):
+            for x, y, z, w in rows:
+                index = snapshot_index(p, q, x, y, z)
+                if index is None:
+                    rest[i].append((x, y, z, w))
+                else:
+                    cells[i][index] = w
+        return b''.join([
+            self.encode_blocks(BLOCK, p, q, rest[0]),
+            self.encode_blocks(LIGHT, p, q, rest[1]),
+            snapshot_frame(p, q, key, cells[0], cells[1], signs),
+        ])
     def send_raw(self, data):
         if data:
             self.queue.put(data)
     def send(self, *args):
-        self.send_raw(packet(*args))
+        self.send_raw(self.encode(*args))
 
 class Model(object):
     def __init__(self, seed):
         self.world = World(seed)
         self.clients = []
         self.queue = Queue.Queue()
+        self.edits = {}
+        self.grid = {}
+        self.next_tick = 0
         self.commands = {
             AUTHENTICATE: self.on_authenticate,
             CHUNK: self.on_chunk,
@@ -185,6 +333,7 @@ class Model(object):
             (re.compile(r'^/nick(?:\s+([^,\s]+))?$'), self.on_nick),
             (re.compile(r'^/spawn$'), self.on_spawn),
             (re.compile(r'^/bgoto(?:\s+(.+))?$'), self.on_bgoto),
+            (re.compile(r'^/blist$'), self.on_blist),
             (re.compile(r'^/goto(?:\s+(\S+))?$'), self.on_goto),
             (re.compile(r'^/pq\s+(-?[0-9]+)\s*,?\s*(-?[0-9]+)$'), self.on_pq),
             (re.compile(r'^/help(?:\s+(\S+))?$'), self.on_help),
@@ -197,19 +346,26 @@ class Model(object):
     def run(self):
         self.connection = sqlite3.connect(DB_PATH)
         self.create_tables()
+        self.load_bible_positions()
         self.commit()
         while True:
             try:
                 if time.time() - self.last_commit > COMMIT_INTERVAL:
                     self.commit()
+                    self.refresh_bible_positions()
+                if time.time() >= self.next_tick:
+                    self.next_tick = time.time() + TICK_INTERVAL
+                    self.send_edits()
+                    self.send_pending_positions()
                 self.dequeue()
             except Exception:
                 traceback.print_exc()
     def enqueue(self, func, *args, **kwargs):
         self.queue.put((func, args, kwargs))
     def dequeue(self):
+        timeout = max(self.next_tick - time.time(), 0)
         try:
-            func, args, kwargs = self.queue.get(timeout=5)
+            func, args, kwargs = self.queue.get(timeout=timeout)
             func(*args, **kwargs)
         except Queue.Empty:
             pass
@@ -263,6 +419,32 @@ class Model(object):
         ]
         for query in queries:
             self.execute(query)
+    def load_bible_positions(self):
+        # mirror bible_position so /bgoto and /blist never hit sqlite
+        self.bible_version = self.get_data_version()
+        self.bible_positions = {}
+        self.bible_columns = {}
+        query = 'select book, chapter, verse, x, y, z from bible_position;'
+        try:
+            rows = list(self.execute(query))
+        except sqlite3.OperationalError:
+            rows = []
+        for book, chapter, verse, x, y, z in rows:
+            self.bible_positions[(book, chapter, verse)] = (x, y, z)
+            if book != 'INFO' and verse > 0:
+                self.bible_columns.setdefault(x, []).append(
+                    (z, book, chapter, verse))
+        for column in self.bible_columns.values():
+            column.sort()
+        self.bible_column_xs = sorted(self.bible_columns)
+        log('BIBLE', len(self.bible_positions), 'positions')
+    def get_data_version(self):
+        return self.execute('pragma data_version;').fetchone()[0]
+    def refresh_bible_positions(self):
+        # the Bible is generated by another process, whose commits show up
+        # as a new data_version on this connection
+        if self.get_data_version() != self.bible_version:
+            self.load_bible_positions()
     def get_default_block(self, x, y, z):
         p, q = chunked(x), chunked(z)
         chunk = self.world.get_chunk(p, q)
@@ -294,9 +476,7 @@ class Model(object):
         client.send(TALK, 'Welcome to Craft!')
         client.send(TALK, 'Type "/help" for a list of commands.')
         self.send_position(client)
-        self.send_positions(client)
         self.send_nick(client)
-        self.send_nicks(client)
     def on_data(self, client, data):
         #log('RECV', client.client_id, data)
         args = data.split(',')
@@ -310,13 +490,21 @@ class Model(object):
         self.send_disconnect(client)
         self.send_talk('%s has disconnected from the server.' % client.nick)
     def on_version(self, client, version):
-        if client.version is not None:
-            return
         version = int(version)
-        if version != 1:
-            client.stop()
-            return
-        client.version = version
+        if client.version is None:
+            if version != 1:
+                client.stop()
+                return
+            client.version = version
+        elif version == 2 and client.version == 1 and BINARY_PROTOCOL:
+            # the acknowledgement is the last text line
+            client.send(VERSION, version)
+            client.version = version
+            client.binary = True
+        elif version == 3 and client.version is not None:
+            # meshes chunk edges from the neighbouring chunks, so it does
+            # not need the padding copies sent to older clients
+            client.padding = False
         # TODO: client.start() here
     def on_authenticate(self, client, username, access_token):
         user_id = None
@@ -337,44 +525,74 @@ class Model(object):
         self.send_nick(client)
         # TODO: has left message if was already authenticated
         self.send_talk('%s has joined the game.' % client.nick)
-    def on_chunk(self, client, p, q, key=0):
-        packets = []
-        p, q, key = map(int, (p, q, key))
+    def on_chunk(self, client, *args):
+        # C,p,q[,key] or, from version 2 clients, any number of p,q,key in
+        # the order they should be answered
+        args = list(map(int, args))
+        if len(args) == 2:
+            args.append(0)
+        for i in range(0, len(args) - 2, 3):
+            self.send_chunk(client, *args[i:i + 3])
+    def send_chunk(self, client, p, q, key):
         query = (
             'select rowid, x, y, z, w from block where '
             'p = :p and q = :q and rowid > :key;'
         )
         rows = self.execute(query, dict(p=p, q=q, key=key))
         max_rowid = 0
-        blocks = 0
+        blocks = []
         for rowid, x, y, z, w in rows:
-            blocks += 1
-            packets.append(packet(BLOCK, p, q, x, y, z, w))
+            blocks.append((x, y, z, w))
             max_rowid = max(max_rowid, rowid)
+        if client.padding:
+            for rowid, x, y, z, w in self.get_padding(p, q, key):
+                blocks.append((x, y, z, -w))
+                max_rowid = max(max_rowid, rowid)
         query = (
             'select x, y, z, w from light where '
             'p = :p and q = :q;'
         )
-        rows = self.execute(query, dict(p=p, q=q))
-        lights = 0
-        for x, y, z, w in rows:
-            lights += 1
-            packets.append(packet(LIGHT, p, q, x, y, z, w))
+        lights = list(self.execute(query, dict(p=p, q=q)))
         query = (
             'select x, y, z, face, text from sign where '
             'p = :p and q = :q;'
         )
-        rows = self.execute(query, dict(p=p, q=q))
-        signs = 0
-        for x, y, z, face, text in rows:
-            signs += 1
-            packets.append(packet(SIGN, p, q, x, y, z, face, text))
+        signs = list(self.execute(query, dict(p=p, q=q)))
+        if client.binary and len(blocks) + len(lights) >= SNAPSHOT_SIZE:
+            client.send_raw(client.encode_snapshot(
+                p, q, max_rowid or key, blocks, lights, signs))
+            return
+        packets = [
+            client.encode_blocks(BLOCK, p, q, blocks),
+            client.encode_blocks(LIGHT, p, q, lights),
+        ]
+        for x, y, z, face, text in signs:
+            packets.append(client.encode(SIGN, p, q, x, y, z, face, text))
         if blocks:
-            packets.append(packet(KEY, p, q, max_rowid))
+            packets.append(client.encode(KEY, p, q, max_rowid))
         if blocks or lights or signs:
-            packets.append(packet(REDRAW, p, q))
-        packets.append(packet(CHUNK, p, q))
-        client.send_raw(''.join(packets))
+            packets.append(client.encode(REDRAW, p, q))
+        packets.append(client.encode(CHUNK, p, q))
+        client.send_raw(b''.join(packets))
+    def get_padding(self, p, q, key):
+        # the blocks neighbouring chunks own along the edges of this one,
+        # which older clients expect to be stored with it as -w
+        query = (
+            'select rowid, x, y, z, w from block where '
+            'p = :p and q = :q and x >= :x0 and x <= :x1 and '
+            'z >= :z0 and z <= :z1 and rowid > :key;'
+        )
+        x0, z0 = p * CHUNK_SIZE, q * CHUNK_SIZE
+        ranges = [(-1, -1), (0, CHUNK_SIZE - 1), (CHUNK_SIZE, CHUNK_SIZE)]
+        result = []
+        for dp in range(-1, 2):
+            for dq in range(-1, 2):
+                if dp == 0 and dq == 0:
+                    continue
+                (a, b), (c, d) = ranges[dp + 1], ranges[dq + 1]
+                result.extend(self.execute(query, dict(p=p + dp, q=q + dq,
+                    x0=x0 + a, x1=x0 + b, z0=z0 + c, z1=z0 + d, key=key)))
+        return result
     def on_block(self, client, x, y, z, w):
         x, y, z, w = map(int, (x, y, z, w))
         p, q = chunked(x), chunked(z)
@@ -418,9 +636,7 @@ class Model(object):
                     continue
                 if dz and chunked(z + dz) == q:
                     continue
-                np, nq = p + dx, q + dz
-                self.execute(query, dict(p=np, q=nq, x=x, y=y, z=z, w=-w))
-                self.send_block(client, np, nq, x, y, z, -w)
+                self.send_padding(client, p + dx, q + dz, x, y, z, -w)
         if w == 0:
             query = (
                 'delete from sign where '
@@ -542,10 +758,9 @@ class Model(object):
         # Bible navigation: /bgoto [BOOK [CHAPTER[:VERSE]]]
         if args is None or args.strip() == '':
             # No arguments - teleport to INFO area
-            query = 'select x, y, z from bible_position where book = ? and chapter = ? and verse = ?;'
-            rows = list(self.execute(query, ('INFO', -1, 0)))
-            if rows:
-                x, y, z = rows[0]
+            position = self.get_bible_position('INFO', -1, 0)
+            if position:
+                x, y, z = position
                 # Teleport 106 blocks above the text
                 client.position = (x, y + 106, z, 0, -45)
                 client.send(YOU, client.client_id, *client.position)
@@ -607,12 +822,11 @@ class Model(object):
                 client.send(TALK, 'Book not found! Use /bgoto to see all books.')
                 return
 
-            # Query database for position
-            query = 'select x, y, z from bible_position where book = ? and chapter = ? and verse = ?;'
-            rows = list(self.execute(query, (book, chapter, verse)))
+            # Look up position
+            position = self.get_bible_position(book, chapter, verse)
 
-            if rows:
-                x, y, z = rows[0]
+            if position:
+                x, y, z = position
                 # Teleport 106 blocks above the text
                 client.position = (x, y + 106, z, 0, -45)
                 client.send(YOU, client.client_id, *client.position)
@@ -632,6 +846,30 @@ class Model(object):
                 else:
                     client.send(TALK, 'ERROR: %s not found in database' % book)
                 client.send(TALK, 'The Bible has not been generated on the server yet.')
+    def get_bible_position(self, book, chapter, verse):
+        key = (book, chapter, verse)
+        if key not in self.bible_positions:
+            self.refresh_bible_positions()
+        return self.bible_positions.get(key)
+    def on_blist(self, client):
+        if not self.bible_column_xs:
+            self.refresh_bible_positions()
+        if not self.bible_column_xs:
+            client.send(TALK, 'ERROR: Bible not generated on server')
+            return
+        x, _, z = client.position[:3]
+        # each book is one scroll at a fixed x; pick the closest
+        xs = self.bible_column_xs
+        i = bisect_left(xs, x)
+        candidates = xs[max(i - 1, 0):i + 1]
+        column = self.bible_columns[min(candidates, key=lambda c: abs(c - x))]
+        i = bisect_left(column, (z,))
+        nearby = column[max(i - 4, 0):i + 4]
+        nearby.sort(key=lambda row: abs(row[0] - z))
+        for vz, book, chapter, verse in nearby:
+            vx, vy, _ = self.bible_positions[(book, chapter, verse)]
+            client.send(TALK, '%s %d:%d (%d, %d, %d)' % (
+                book, chapter, verse, vx, vy, vz))
     def on_help(self, client, topic=None):
         if topic is None:
             client.send(TALK, 'Type "t" to chat. Type "/" to type commands:')
@@ -676,42 +914,121 @@ class Model(object):
     def on_list(self, client):
         client.send(TALK,
             'Players: %s' % ', '.join(x.nick for x in self.clients))
-    def send_positions(self, client):
-        for other in self.clients:
-            if other == client:
-                continue
-            client.send(POSITION, other.client_id, *other.position)
+    # Clients only hear about players within INTEREST_RADIUS chunks of
+    # them, found through a grid of the chunks players are in. Seeing is
+    # mutual: a player that comes into range is introduced to both sides
+    # with its position and nick, and one that leaves is disconnected on
+    # both. Positions of players further than a chunk away are sent at
+    # most every POSITION_DELAY seconds per chunk of distance; the latest
+    # one is held back until then.
+    def move_in_grid(self, client):
+        x, _, z = client.position[:3]
+        cell = (chunked(x), chunked(z))
+        if cell == client.cell:
+            return
+        self.remove_from_grid(client)
+        self.grid.setdefault(cell, set()).add(client)
+        client.cell = cell
+    def remove_from_grid(self, client):
+        clients = self.grid.get(client.cell)
+        if clients:
+            clients.discard(client)
+            if not clients:
+                del self.grid[client.cell]
+        client.cell = None
+    def nearby(self, client):
+        p, q = client.cell
+        r = INTEREST_RADIUS
+        result = set()
+        for a in range(p - r, p + r + 1):
+            for b in range(q - r, q + r + 1):
+                result.update(self.grid.get((a, b), ()))
+        result.discard(client)
+        return result
+    def show(self, client, other):
+        for viewer, player in ((client, other), (other, client)):
+            viewer.visible.add(player)
+            viewer.send(POSITION, player.client_id, *player.position)
+            viewer.send(NICK, player.client_id, player.nick)
+            viewer.sent[player] = time.time()
+    def hide(self, client, other):
+        for viewer, player in ((client, other), (other, client)):
+            viewer.visible.discard(player)
+            viewer.sent.pop(player, None)
+            viewer.pending.discard(player)
+            viewer.send(DISCONNECT, player.client_id)
+    def update_position(self, viewer, player, now):
+        distance = max(
+            abs(viewer.cell[0] - player.cell[0]),
+            abs(viewer.cell[1] - player.cell[1]))
+        delay = POSITION_DELAY * max(distance - 1, 0)
+        if now - viewer.sent.get(player, 0) >= delay:
+            viewer.send(POSITION, player.client_id, *player.position)
+            viewer.sent[player] = now
+            viewer.pending.discard(player)
+        else:
+            viewer.pending.add(player)
+    def send_pending_positions(self):
+        now = time.time()
+        for viewer in self.clients:
+            for player in list(viewer.pending):
+                self.update_position(viewer, player, now)
     def send_position(self, client):
-        for other in self.clients:
-            if other == client:
-                continue
-            other.send(POSITION, client.client_id, *client.position)
-    def send_nicks(self, client):
-        for other in self.clients:
-            if other == client:
-                continue
-            client.send(NICK, other.client_id, other.nick)
+        self.move_in_grid(client)
+        nearby = self.nearby(client)
+        for other in client.visible - nearby:
+            self.hide(client, other)
+        now = time.time()
+        for other in nearby:
+            if other in client.visible:
+                self.update_position(other, client, now)
+            else:
+                self.show(client, other)
     def send_nick(self, client):
-        for other in self.clients:
+        client.send(NICK, client.client_id, client.nick)
+        for other in client.visible:
             other.send(NICK, client.client_id, client.nick)
     def send_disconnect(self, client):
-        for other in self.clients:
-            if other == client:
-                continue
+        for other in client.visible:
+            other.visible.discard(client)
+            other.sent.pop(client, None)
+            other.pending.discard(client)
             other.send(DISCONNECT, client.client_id)
+        client.visible = set()
+        self.remove_from_grid(client)
+    # Block and light edits are collected for a tick and sent per chunk,
+    # keeping only the latest value of each cell and a single redraw.
+    # Each cell remembers who edited it last; that client already has it.
+    def queue_edit(self, kind, client, p, q, x, y, z, w):
+        if not self.edits:
+            self.next_tick = time.time() + TICK_INTERVAL
+        cells = self.edits.setdefault((p, q), ({}, {}, {}))
+        cells[kind][(x, y, z)] = (w, client)
+    def send_edits(self):
+        edits, self.edits = self.edits, {}
+        for client in self.clients:
+            packets = []
+            for (p, q), cells in edits.items():
+                blocks, lights, padding = [
+                    [(x, y, z, w) for (x, y, z), (w, other) in edited.items()
+                        if other != client] for edited in cells]
+                if client.padding:
+                    blocks.extend(padding)
+                if blocks or lights:
+                    packets.append(client.encode_blocks(BLOCK, p, q, blocks))
+                    packets.append(client.encode_blocks(LIGHT, p, q, lights))
+                    packets.append(client.encode(REDRAW, p, q))
+            client.send_raw(b''.join(packets))
     def send_block(self, client, p, q, x, y, z, w):
-        for other in self.clients:
-            if other == client:
-                continue
-            other.send(BLOCK, p, q, x, y, z, w)
-            other.send(REDRAW, p, q)
+        self.queue_edit(0, client, p, q, x, y, z, w)
     def send_light(self, client, p, q, x, y, z, w):
-        for other in self.clients:
-            if other == client:
-                continue
-            other.send(LIGHT, p, q, x, y, z, w)
-            other.send(REDRAW, p, q)
+        self.queue_edit(1, client, p, q, x, y, z, w)
+    def send_padding(self, client, p, q, x, y, z, w):
+        self.queue_edit(2, client, p, q, x, y, z, w)
     def send_sign(self, client, p, q, x, y, z, face, text):
+        # a sign must not arrive ahead of the block it is placed on
+        if self.edits:
+            self.send_edits()
         for other in self.clients:
             if other == client:
                 continue
@@ -730,7 +1047,14 @@ def cleanup():
     chunks = list(conn.execute(query))
     count = 0
     total = 0
+    padding = 0
     delete_query = 'delete from block where x = %d and y = %d and z = %d;'
+    # padding is derived from the neighbouring chunks when it is sent, so
+    # copies stored by older servers are no longer needed
+    padding_query = (
+        'delete from block where p = %d and q = %d and '
+        'x = %d and y = %d and z = %d;'
+    )
     print('begin;')
     for p, q in chunks:
         chunk = world.create_chunk(p, q)
@@ -738,6 +1062,8 @@ def cleanup():
         rows = conn.execute(query, {'p': p, 'q': q})
         for x, y, z, w in rows:
             if chunked(x) != p or chunked(z) != q:
+                padding += 1
+                print(padding_query % (p, q, x, y, z))
                 continue
             total += 1
             if (x, y, z) == last:
@@ -749,6 +1075,7 @@ def cleanup():
     conn.close()
     print('commit;')
     print('%d of %d blocks will be cleaned up' % (count, total), file=sys.stderr)
+    print('%d padding blocks will be removed' % padding, file=sys.stderr)
 
 def main():
     if len(sys.argv) == 2 and sys.argv[1] == 'cleanup':
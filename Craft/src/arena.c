@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+static void arena_insert_block(Arena *arena, int index, int offset, int size) {
+    if (arena->block_count == arena->block_capacity) {
+        arena->block_capacity = arena->block_capacity ?
+            arena->block_capacity * 2 : 16;
+        arena->blocks = (ArenaBlock *)realloc(arena->blocks,
+            sizeof(ArenaBlock) * arena->block_capacity);
+    }
+    memmove(arena->blocks + index + 1, arena->blocks + index,
+        sizeof(ArenaBlock) * (arena->block_count - index));
+    arena->blocks[index].offset = offset;
+    arena->blocks[index].size = size;
+    arena->block_count++;
+}
+
+static void arena_remove_block(Arena *arena, int index) {
+    memmove(arena->blocks + index, arena->blocks + index + 1,
+        sizeof(ArenaBlock) * (arena->block_count - index - 1));
+    arena->block_count--;
+}
+
+void arena_alloc(Arena *arena, int stride, int capacity) {
+    memset(arena, 0, sizeof(Arena));
+    arena->stride = stride;
+    arena->capacity = capacity;
+    glGenBuffers(1, &arena->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, arena->buffer);
+    glBufferData(GL_ARRAY_BUFFER,
+        sizeof(GLfloat) * stride * capacity, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    arena_insert_block(arena, 0, 0, capacity);
+}
+
+void arena_free(Arena *arena) {
+    if (arena->vao) {
+        glDeleteVertexArrays(1, &arena->vao);
+    }
+    glDeleteBuffers(1, &arena->buffer);
+    free(arena->blocks);
+    free(arena->batch_first);
+    free(arena->batch_size);
+    memset(arena, 0, sizeof(Arena));
+}
+
+// first fit over the free list, returns the vertex offset or -1 if full
+int arena_malloc(Arena *arena, int count) {
+    int size = ARENA_ROUND(count);
+    for (int i = 0; i < arena->block_count; i++) {
+        ArenaBlock *block = arena->blocks + i;
+        if (block->size < size) {
+            continue;
+        }
+        int offset = block->offset;
+        block->offset += size;
+        block->size -= size;
+        if (block->size == 0) {
+            arena_remove_block(arena, i);
+        }
+        arena->used += size;
+        return offset;
+    }
+    return -1;
+}
+
+void arena_release(Arena *arena, int offset, int count) {
+    int size = ARENA_ROUND(count);
+    int index = 0;
+    while (index < arena->block_count &&
+        arena->blocks[index].offset < offset)
+    {
+        index++;
+    }
+    arena->used -= size;
+    ArenaBlock *prev = index > 0 ? arena->blocks + index - 1 : 0;
+    ArenaBlock *next = index < arena->block_count ?
+        arena->blocks + index : 0;
+    int join_prev = prev && prev->offset + prev->size == offset;
+    int join_next = next && offset + size == next->offset;
+    if (join_prev && join_next) {
+        prev->size += size + next->size;
+        arena_remove_block(arena, index);
+    }
+    else if (join_prev) {
+        prev->size += size;
+    }
+    else if (join_next) {
+        next->offset = offset;
+        next->size += size;
+    }
+    else {
+        arena_insert_block(arena, index, offset, size);
+    }
+}
+
+void arena_upload(Arena *arena, int offset, int count, const GLfloat *data) {
+    int bytes = sizeof(GLfloat) * arena->stride;
+    glBindBuffer(GL_ARRAY_BUFFER, arena->buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, bytes * offset, bytes * count, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void arena_batch_add(Arena *arena, int offset, int count) {
+    if (arena->batch_count == arena->batch_capacity) {
+        arena->batch_capacity = arena->batch_capacity ?
+            arena->batch_capacity * 2 : 64;
+        arena->batch_first = (GLint *)realloc(arena->batch_first,
+            sizeof(GLint) * arena->batch_capacity);
+        arena->batch_size = (GLsizei *)realloc(arena->batch_size,
+            sizeof(GLsizei) * arena->batch_capacity);
+    }
+    arena->batch_first[arena->batch_count] = offset;
+    arena->batch_size[arena->batch_count] = count;
+    arena->batch_count++;
+}
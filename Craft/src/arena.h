@@ -0,0 +1,37 @@
+#ifndef _arena_h_
+#define _arena_h_
+
+#include <GL/glew.h>
+
+// allocations are rounded up to this many vertices to limit fragmentation
+#define ARENA_ALIGN 64
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+typedef struct {
+    int offset;
+    int size;
+} ArenaBlock;
+
+typedef struct {
+    GLuint buffer;
+    GLuint vao;
+    int stride;
+    int capacity;
+    int used;
+    int block_count;
+    int block_capacity;
+    ArenaBlock *blocks;
+    int batch_count;
+    int batch_capacity;
+    GLint *batch_first;
+    GLsizei *batch_size;
+} Arena;
+
+void arena_alloc(Arena *arena, int stride, int capacity);
+void arena_free(Arena *arena);
+int arena_malloc(Arena *arena, int count);
+void arena_release(Arena *arena, int offset, int count);
+void arena_upload(Arena *arena, int offset, int count, const GLfloat *data);
+void arena_batch_add(Arena *arena, int offset, int count);
+
+#endif
@@ -19,6 +19,14 @@ static void generate_landing_platform_internal(
     int center_x, int center_z, int platform_y,
     void (*block_func)(int x, int y, int z, int w));
 
+// Forward declarations for the in-memory verse cache (defined after bible_books)
+static int load_text_index(const char *bible_path);
+static void free_text_index(void);
+static const char *find_verse_text(const char *book, int chapter, int verse);
+static int find_max_verse(const char *book, int chapter);
+static void record_position(const char *book, int chapter, int verse, int x, int y, int z);
+static void free_position_table(void);
+
 // Helper function to trim whitespace
 static void trim_whitespace(char *str) {
     char *end;
@@ -109,6 +117,10 @@ int bible_init(const char *bible_path) {
     bible_initialized = 1;
     printf("Bible system initialized with file: %s\n", bible_path);
 
+    // Load verse text and build the search index; lookups fall back to
+    // scanning the file if this fails
+    load_text_index(bible_path);
+
     // Load daily reading Z offsets from database if available
     int loaded = db_load_daily_reading_z_offsets(daily_reading_z_offsets, 365);
     if (loaded > 0) {
@@ -123,6 +135,8 @@ void bible_cleanup(void) {
         free(bible_file_path);
         bible_file_path = NULL;
     }
+    free_text_index();
+    free_position_table();
     bible_initialized = 0;
 }
 
@@ -135,6 +149,13 @@ int bible_get_verse_text(
         return 0;
     }
 
+    const char *cached = find_verse_text(book, chapter, verse);
+    if (cached) {
+        strncpy(text_buffer, cached, buffer_size - 1);
+        text_buffer[buffer_size - 1] = '\0';
+        return 1;
+    }
+
     FILE *f = fopen(bible_file_path, "r");
     if (!f) {
         fprintf(stderr, "Failed to open Bible file\n");
@@ -475,7 +496,7 @@ int bible_render_chapter_flat(
                     snprintf(full_text, sizeof(full_text), "%d. %s", verse_num, verse_text);
 
                     // Save position before rendering (for teleportation)
-                    db_insert_bible_position(book, chapter, verse_num, x, y, current_z);
+                    record_position(book, chapter, verse_num, x, y, current_z);
 
                     // Render flat
                     int lines = voxel_text_render_flat(
@@ -576,7 +597,7 @@ static int render_book_scroll(
     // Render each chapter sequentially (starting from start_chapter)
     for (int chapter = start_chapter; chapter <= num_chapters; chapter++) {
         // Save chapter start position (verse 0 = chapter start)
-        db_insert_bible_position(book_name, chapter, 0, x, y, current_z);
+        record_position(book_name, chapter, 0, x, y, current_z);
         printf("  Saved position: %s %d:0 at (%d, %d, %d)\n", book_name, chapter, x, y, current_z);
 
         // Add chapter header
@@ -762,7 +783,7 @@ int bible_generate_world(
 
         // Save info area CENTER position to database (chapter -1, verse 0 = info area marker)
         // This is where we teleport to - the center of the text, not the start
-        db_insert_bible_position("INFO", -1, 0, info_center_x, info_y, info_z);
+        record_position("INFO", -1, 0, info_center_x, info_y, info_z);
 
         // Commit INFO position immediately so /bgoto works right away!
         db_commit_sync();
@@ -779,7 +800,7 @@ int bible_generate_world(
                i + 1, BIBLE_BOOK_COUNT, bible_books[i].name, current_x);
 
         // Save book start position (chapter 0, verse 0 = book start)
-        db_insert_bible_position(bible_books[i].name, 0, 0, current_x, start_y, start_z);
+        record_position(bible_books[i].name, 0, 0, current_x, start_y, start_z);
         printf("  Saved book start: %s at (%d, %d, %d)\n", bible_books[i].name, current_x, start_y, start_z);
 
         // Commit book start immediately so it's teleportable right away!
@@ -1025,6 +1046,11 @@ int bible_get_verse_count(const char *book, int chapter) {
         return 0;
     }
 
+    int cached = find_max_verse(book, chapter);
+    if (cached >= 0) {
+        return cached;
+    }
+
     // Open Bible file and count verses in this chapter
     FILE *f = fopen(bible_file_path, "r");
     if (!f) {
@@ -1060,6 +1086,745 @@ int bible_get_verse_count(const char *book, int chapter) {
     return max_verse; // Return highest verse number found
 }
 
+// ============================================================================
+// VERSE TEXT CACHE AND SEARCH INDEX
+// ============================================================================
+
+// The whole KJV file is loaded once at bible_init time. Verse lookups become
+// a binary search over bible_verses and /bsearch is answered from an inverted
+// word -> verse index instead of scanning the file.
+
+#define BIBLE_MAX_WORD_LENGTH 32
+
+typedef struct {
+    unsigned char book;         // index into bible_books
+    unsigned short chapter;
+    unsigned short verse;
+    unsigned int text;          // offset of the verse text in bible_text
+} BibleVerse;
+
+typedef struct {
+    unsigned int word;          // offset of the word in bible_words (0 = empty)
+    unsigned int hash;
+    unsigned int start;         // first posting in bible_postings
+    unsigned int count;         // number of verses containing the word
+    unsigned int last;          // last verse counted (used while building)
+} BibleWordEntry;
+
+static char *bible_text = NULL;
+static BibleVerse *bible_verses = NULL;
+static int bible_verse_count = 0;
+
+static char *bible_words = NULL;
+static unsigned int bible_words_size = 0;
+static BibleWordEntry *bible_word_table = NULL;
+static unsigned int bible_word_mask = 0;
+static unsigned int bible_word_count = 0;
+static unsigned int *bible_postings = NULL;
+
+static int find_book_index(const char *book) {
+    if (!book) {
+        return -1;
+    }
+    for (int i = 0; i < BIBLE_BOOK_COUNT; i++) {
+#ifdef _WIN32
+        if (_stricmp(book, bible_books[i].name) == 0) {
+#else
+        if (strcasecmp(book, bible_books[i].name) == 0) {
+#endif
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int compare_verse_key(int book, int chapter, int verse, const BibleVerse *v) {
+    if (book != v->book) return book < v->book ? -1 : 1;
+    if (chapter != v->chapter) return chapter < v->chapter ? -1 : 1;
+    if (verse != v->verse) return verse < v->verse ? -1 : 1;
+    return 0;
+}
+
+// Returns the index of the first verse >= (book, chapter, verse)
+static int lower_bound_verse(int book, int chapter, int verse) {
+    int lo = 0;
+    int hi = bible_verse_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (compare_verse_key(book, chapter, verse, bible_verses + mid) > 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int find_verse(const char *book, int chapter, int verse) {
+    int book_index = find_book_index(book);
+    if (book_index < 0 || !bible_verses) {
+        return -1;
+    }
+    int i = lower_bound_verse(book_index, chapter, verse);
+    if (i < bible_verse_count &&
+        compare_verse_key(book_index, chapter, verse, bible_verses + i) == 0)
+    {
+        return i;
+    }
+    return -1;
+}
+
+static const char *find_verse_text(const char *book, int chapter, int verse) {
+    int i = find_verse(book, chapter, verse);
+    return i < 0 ? NULL : bible_text + bible_verses[i].text;
+}
+
+static int find_max_verse(const char *book, int chapter) {
+    int book_index = find_book_index(book);
+    if (book_index < 0 || !bible_verses) {
+        return -1;
+    }
+    // first verse of the next chapter, then step back one
+    int i = lower_bound_verse(book_index, chapter + 1, 0) - 1;
+    if (i >= 0 && bible_verses[i].book == book_index &&
+        bible_verses[i].chapter == chapter)
+    {
+        return bible_verses[i].verse;
+    }
+    return 0;
+}
+
+static unsigned int hash_word(const char *word, int length) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)word[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Reads the next lowercase word from *text, advancing the pointer.
+// Returns the word length, or 0 at the end of the string.
+static int next_word(const char **text, char *word) {
+    const char *p = *text;
+    while (*p && !isalnum((unsigned char)*p)) {
+        p++;
+    }
+    int length = 0;
+    while (*p && isalnum((unsigned char)*p)) {
+        if (length < BIBLE_MAX_WORD_LENGTH - 1) {
+            word[length++] = tolower((unsigned char)*p);
+        }
+        p++;
+    }
+    word[length] = '\0';
+    *text = p;
+    return length;
+}
+
+static BibleWordEntry *lookup_word(const char *word, unsigned int h) {
+    unsigned int index = h & bible_word_mask;
+    while (1) {
+        BibleWordEntry *entry = bible_word_table + index;
+        if (!entry->word) {
+            return entry;
+        }
+        if (entry->hash == h && strcmp(bible_words + entry->word, word) == 0) {
+            return entry;
+        }
+        index = (index + 1) & bible_word_mask;
+    }
+}
+
+static int grow_word_table(void) {
+    unsigned int old_size = bible_word_mask + 1;
+    BibleWordEntry *old_table = bible_word_table;
+    unsigned int size = old_size * 2;
+    bible_word_table = calloc(size, sizeof(BibleWordEntry));
+    if (!bible_word_table) {
+        bible_word_table = old_table;
+        return 0;
+    }
+    bible_word_mask = size - 1;
+    for (unsigned int i = 0; i < old_size; i++) {
+        BibleWordEntry *entry = old_table + i;
+        if (entry->word) {
+            unsigned int index = entry->hash & bible_word_mask;
+            while (bible_word_table[index].word) {
+                index = (index + 1) & bible_word_mask;
+            }
+            bible_word_table[index] = *entry;
+        }
+    }
+    free(old_table);
+    return 1;
+}
+
+static BibleWordEntry *add_word(const char *word, int length) {
+    unsigned int h = hash_word(word, length);
+    BibleWordEntry *entry = lookup_word(word, h);
+    if (entry->word) {
+        return entry;
+    }
+    if ((bible_word_count + 1) * 2 > bible_word_mask + 1) {
+        if (!grow_word_table()) {
+            return NULL;
+        }
+        entry = lookup_word(word, h);
+    }
+    char *words = realloc(bible_words, bible_words_size + length + 1);
+    if (!words) {
+        return NULL;
+    }
+    bible_words = words;
+    memcpy(bible_words + bible_words_size, word, length + 1);
+    entry->word = bible_words_size;
+    entry->hash = h;
+    entry->last = (unsigned int)-1;
+    bible_words_size += length + 1;
+    bible_word_count++;
+    return entry;
+}
+
+static void free_text_index(void) {
+    free(bible_text);
+    free(bible_verses);
+    free(bible_words);
+    free(bible_word_table);
+    free(bible_postings);
+    bible_text = NULL;
+    bible_verses = NULL;
+    bible_words = NULL;
+    bible_word_table = NULL;
+    bible_postings = NULL;
+    bible_verse_count = 0;
+    bible_words_size = 0;
+    bible_word_mask = 0;
+    bible_word_count = 0;
+}
+
+// Two passes over the verses: count the number of verses each word appears
+// in, then fill the postings. Verses are visited in canonical order so every
+// posting list comes out sorted.
+static int build_search_index(void) {
+    char word[BIBLE_MAX_WORD_LENGTH];
+    bible_word_mask = 16384 - 1;
+    bible_word_table = calloc(bible_word_mask + 1, sizeof(BibleWordEntry));
+    bible_words_size = 1; // offset 0 marks an empty slot
+    bible_words = malloc(bible_words_size);
+    if (!bible_word_table || !bible_words) {
+        return 0;
+    }
+    unsigned int posting_count = 0;
+    for (int i = 0; i < bible_verse_count; i++) {
+        const char *p = bible_text + bible_verses[i].text;
+        int length;
+        while ((length = next_word(&p, word))) {
+            BibleWordEntry *entry = add_word(word, length);
+            if (!entry) {
+                return 0;
+            }
+            if (entry->last != (unsigned int)i) {
+                entry->last = i;
+                entry->count++;
+                posting_count++;
+            }
+        }
+    }
+    bible_postings = malloc(sizeof(unsigned int) * (posting_count + 1));
+    if (!bible_postings) {
+        return 0;
+    }
+    unsigned int start = 0;
+    for (unsigned int i = 0; i <= bible_word_mask; i++) {
+        BibleWordEntry *entry = bible_word_table + i;
+        if (entry->word) {
+            entry->start = start;
+            entry->last = (unsigned int)-1;
+            start += entry->count;
+            entry->count = 0;
+        }
+    }
+    for (int i = 0; i < bible_verse_count; i++) {
+        const char *p = bible_text + bible_verses[i].text;
+        int length;
+        while ((length = next_word(&p, word))) {
+            BibleWordEntry *entry = lookup_word(word, hash_word(word, length));
+            if (entry->last != (unsigned int)i) {
+                entry->last = i;
+                bible_postings[entry->start + entry->count++] = i;
+            }
+        }
+    }
+    return 1;
+}
+
+static int verse_compare(const void *a, const void *b) {
+    const BibleVerse *v = (const BibleVerse *)b;
+    const BibleVerse *u = (const BibleVerse *)a;
+    return compare_verse_key(u->book, u->chapter, u->verse, v);
+}
+
+// Parses "Book C:V\ttext" lines from the KJV file held in bible_text.
+// Lines are terminated in place so verse text can be referenced directly.
+static int parse_verses(size_t size) {
+    int capacity = 32768;
+    bible_verses = malloc(sizeof(BibleVerse) * capacity);
+    if (!bible_verses) {
+        return 0;
+    }
+    char *line = bible_text;
+    char *end = bible_text + size;
+    while (line < end) {
+        char *next = memchr(line, '\n', end - line);
+        if (next) {
+            *next = '\0';
+            next++;
+        }
+        else {
+            next = end;
+        }
+        size_t length = strlen(line);
+        if (length > 0 && line[length - 1] == '\r') {
+            line[length - 1] = '\0';
+        }
+        char *tab = strchr(line, '\t');
+        char *space = tab;
+        while (space && space > line && *space != ' ') {
+            space--;
+        }
+        int chapter, verse;
+        if (tab && space > line &&
+            sscanf(space + 1, "%d:%d", &chapter, &verse) == 2)
+        {
+            *space = '\0';
+            int book = find_book_index(line);
+            *space = ' ';
+            if (book >= 0) {
+                if (bible_verse_count == capacity) {
+                    capacity *= 2;
+                    BibleVerse *verses = realloc(
+                        bible_verses, sizeof(BibleVerse) * capacity);
+                    if (!verses) {
+                        return 0;
+                    }
+                    bible_verses = verses;
+                }
+                BibleVerse *v = bible_verses + bible_verse_count++;
+                v->book = book;
+                v->chapter = chapter;
+                v->verse = verse;
+                v->text = (tab + 1) - bible_text;
+            }
+        }
+        line = next;
+    }
+    // the file is in canonical order already, but lookups depend on it
+    qsort(bible_verses, bible_verse_count, sizeof(BibleVerse), verse_compare);
+    return bible_verse_count > 0;
+}
+
+static int load_text_index(const char *bible_path) {
+    clock_t start = clock();
+    FILE *f = fopen(bible_path, "rb");
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(f);
+        return 0;
+    }
+    bible_text = malloc(size + 1);
+    if (!bible_text) {
+        fclose(f);
+        return 0;
+    }
+    size_t read = fread(bible_text, 1, size, f);
+    fclose(f);
+    bible_text[read] = '\0';
+    if (!parse_verses(read) || !build_search_index()) {
+        fprintf(stderr, "Failed to build Bible search index\n");
+        free_text_index();
+        return 0;
+    }
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("Bible search index: %d verses, %u words, %.1f ms\n",
+        bible_verse_count, bible_word_count, elapsed * 1000.0);
+    return 1;
+}
+
+// Returns the index of the first posting in list[lo..count) that is >= value
+static unsigned int gallop(
+    const unsigned int *list, unsigned int lo, unsigned int count,
+    unsigned int value)
+{
+    unsigned int step = 1;
+    unsigned int hi = lo;
+    while (hi < count && list[hi] < value) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > count) {
+        hi = count;
+    }
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (list[mid] < value) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int bible_search(
+    const char *query, BibleSearchResult *results, int max_results)
+{
+    BibleWordEntry *terms[16];
+    unsigned int positions[16];
+    int term_count = 0;
+    char word[BIBLE_MAX_WORD_LENGTH];
+    int length;
+    if (!bible_word_table || !query) {
+        return 0;
+    }
+    while ((length = next_word(&query, word)) && term_count < 16) {
+        BibleWordEntry *entry = lookup_word(word, hash_word(word, length));
+        if (!entry->word) {
+            return 0;
+        }
+        terms[term_count++] = entry;
+    }
+    if (term_count == 0) {
+        return 0;
+    }
+    // intersect starting from the rarest word
+    for (int i = 1; i < term_count; i++) {
+        for (int j = i; j > 0 && terms[j]->count < terms[j - 1]->count; j--) {
+            BibleWordEntry *temp = terms[j];
+            terms[j] = terms[j - 1];
+            terms[j - 1] = temp;
+        }
+    }
+    for (int i = 0; i < term_count; i++) {
+        positions[i] = 0;
+    }
+    int found = 0;
+    const unsigned int *base = bible_postings + terms[0]->start;
+    for (unsigned int i = 0; i < terms[0]->count; i++) {
+        unsigned int verse = base[i];
+        int match = 1;
+        for (int j = 1; j < term_count && match; j++) {
+            const unsigned int *list = bible_postings + terms[j]->start;
+            positions[j] = gallop(list, positions[j], terms[j]->count, verse);
+            if (positions[j] >= terms[j]->count) {
+                return found;
+            }
+            match = list[positions[j]] == verse;
+        }
+        if (match) {
+            if (found < max_results) {
+                BibleVerse *v = bible_verses + verse;
+                results[found].book = bible_books[v->book].name;
+                results[found].chapter = v->chapter;
+                results[found].verse = v->verse;
+                results[found].text = bible_text + v->text;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+// ============================================================================
+// VERSE POSITION TABLE
+// ============================================================================
+
+// Mirror of the bible_position table, kept sorted by (book, chapter, verse)
+// so /bgoto lookups are a binary search instead of a locked SQLite query.
+// A second index sorted by (x, z) answers nearest-verse queries for /blist.
+
+#define INFO_BOOK_INDEX -1
+
+typedef struct {
+    short book;                 // index into bible_books, -1 for INFO
+    short chapter;
+    short verse;
+    int x;
+    int y;
+    int z;
+} BiblePosition;
+
+static BiblePosition *bible_positions = NULL;
+static int bible_position_count = 0;
+static int bible_position_capacity = 0;
+static int *bible_positions_by_xz = NULL;
+static int bible_positions_by_xz_count = 0;
+static int bible_positions_by_xz_dirty = 1;
+
+static int position_book_index(const char *book) {
+    if (strcmp(book, "INFO") == 0) {
+        return INFO_BOOK_INDEX;
+    }
+    int index = find_book_index(book);
+    return index < 0 ? -2 : index;
+}
+
+static int compare_position_key(
+    int book, int chapter, int verse, const BiblePosition *p)
+{
+    if (book != p->book) return book < p->book ? -1 : 1;
+    if (chapter != p->chapter) return chapter < p->chapter ? -1 : 1;
+    if (verse != p->verse) return verse < p->verse ? -1 : 1;
+    return 0;
+}
+
+static int lower_bound_position(int book, int chapter, int verse) {
+    int lo = 0;
+    int hi = bible_position_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (compare_position_key(book, chapter, verse, bible_positions + mid) > 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int compare_positions(const void *a, const void *b) {
+    const BiblePosition *p = (const BiblePosition *)a;
+    return compare_position_key(
+        p->book, p->chapter, p->verse, (const BiblePosition *)b);
+}
+
+static int grow_positions(void) {
+    if (bible_position_count < bible_position_capacity) {
+        return 1;
+    }
+    int capacity = bible_position_capacity ? bible_position_capacity * 2 : 1024;
+    BiblePosition *positions = realloc(
+        bible_positions, sizeof(BiblePosition) * capacity);
+    if (!positions) {
+        return 0;
+    }
+    bible_positions = positions;
+    bible_position_capacity = capacity;
+    return 1;
+}
+
+static void set_position(
+    BiblePosition *p, int book, int chapter, int verse, int x, int y, int z)
+{
+    p->book = book;
+    p->chapter = chapter;
+    p->verse = verse;
+    p->x = x;
+    p->y = y;
+    p->z = z;
+}
+
+// Inserts or replaces a position, keeping the table sorted.
+// Positions arrive in canonical order during generation, so this is
+// almost always an append.
+static void add_position(const char *book, int chapter, int verse, int x, int y, int z) {
+    int book_index = position_book_index(book);
+    if (book_index < INFO_BOOK_INDEX) {
+        return;
+    }
+    int i = lower_bound_position(book_index, chapter, verse);
+    if (i == bible_position_count ||
+        compare_position_key(book_index, chapter, verse, bible_positions + i) != 0)
+    {
+        if (!grow_positions()) {
+            return;
+        }
+        memmove(bible_positions + i + 1, bible_positions + i,
+            sizeof(BiblePosition) * (bible_position_count - i));
+        bible_position_count++;
+    }
+    set_position(bible_positions + i, book_index, chapter, verse, x, y, z);
+    bible_positions_by_xz_dirty = 1;
+}
+
+static void free_position_table(void) {
+    free(bible_positions);
+    free(bible_positions_by_xz);
+    bible_positions = NULL;
+    bible_positions_by_xz = NULL;
+    bible_position_count = 0;
+    bible_position_capacity = 0;
+    bible_positions_by_xz_count = 0;
+    bible_positions_by_xz_dirty = 1;
+}
+
+static void record_position(const char *book, int chapter, int verse, int x, int y, int z) {
+    db_insert_bible_position(book, chapter, verse, x, y, z);
+    add_position(book, chapter, verse, x, y, z);
+}
+
+// Rows come back sorted by book name rather than canonical order, so they
+// are appended as they are and sorted once by bible_load_positions.
+static void load_position(const char *book, int chapter, int verse, int x, int y, int z) {
+    int book_index = position_book_index(book);
+    if (book_index < INFO_BOOK_INDEX || !grow_positions()) {
+        return;
+    }
+    set_position(bible_positions + bible_position_count++,
+        book_index, chapter, verse, x, y, z);
+}
+
+int bible_load_positions(void) {
+    bible_position_count = 0;
+    bible_positions_by_xz_dirty = 1;
+    db_load_bible_positions(load_position);
+    qsort(bible_positions, bible_position_count, sizeof(BiblePosition),
+        compare_positions);
+    // keep one entry per verse
+    int count = 0;
+    for (int i = 0; i < bible_position_count; i++) {
+        BiblePosition *p = bible_positions + i;
+        if (count && compare_positions(p, bible_positions + count - 1) == 0) {
+            bible_positions[count - 1] = *p;
+        }
+        else {
+            bible_positions[count++] = *p;
+        }
+    }
+    bible_position_count = count;
+    int loaded = db_load_daily_reading_z_offsets(daily_reading_z_offsets, 365);
+    if (loaded > 0) {
+        printf("Loaded %d daily reading Z offsets from database.\n", loaded);
+    }
+    printf("Loaded %d Bible positions from database.\n", bible_position_count);
+    return bible_position_count;
+}
+
+int bible_get_position(const char *book, int chapter, int verse, int *x, int *y, int *z) {
+    int book_index = position_book_index(book);
+    if (book_index < INFO_BOOK_INDEX) {
+        return 0;
+    }
+    int i = lower_bound_position(book_index, chapter, verse);
+    if (i == bible_position_count ||
+        compare_position_key(book_index, chapter, verse, bible_positions + i) != 0)
+    {
+        return 0;
+    }
+    *x = bible_positions[i].x;
+    *y = bible_positions[i].y;
+    *z = bible_positions[i].z;
+    return 1;
+}
+
+static int position_xz_compare(const void *a, const void *b) {
+    const BiblePosition *p = bible_positions + *(const int *)a;
+    const BiblePosition *q = bible_positions + *(const int *)b;
+    if (p->x != q->x) return p->x < q->x ? -1 : 1;
+    if (p->z != q->z) return p->z < q->z ? -1 : 1;
+    return 0;
+}
+
+// Only verses are indexed; book, chapter and INFO markers are skipped
+static void update_xz_index(void) {
+    if (!bible_positions_by_xz_dirty) {
+        return;
+    }
+    free(bible_positions_by_xz);
+    bible_positions_by_xz = malloc(sizeof(int) * (bible_position_count + 1));
+    bible_positions_by_xz_count = 0;
+    if (!bible_positions_by_xz) {
+        return;
+    }
+    for (int i = 0; i < bible_position_count; i++) {
+        if (bible_positions[i].book >= 0 && bible_positions[i].verse > 0) {
+            bible_positions_by_xz[bible_positions_by_xz_count++] = i;
+        }
+    }
+    qsort(bible_positions_by_xz, bible_positions_by_xz_count, sizeof(int),
+        position_xz_compare);
+    bible_positions_by_xz_dirty = 0;
+}
+
+// Returns the first entry of the xz index with (x, z) >= the given key
+static int lower_bound_xz(int x, int z) {
+    int lo = 0;
+    int hi = bible_positions_by_xz_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const BiblePosition *p = bible_positions + bible_positions_by_xz[mid];
+        if (p->x < x || (p->x == x && p->z < z)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int bible_find_nearby(int x, int z, BiblePositionResult *results, int max_results) {
+    update_xz_index();
+    int n = bible_positions_by_xz_count;
+    if (n == 0 || max_results <= 0) {
+        return 0;
+    }
+    // every book is a single scroll at one X, so pick the closest column
+    int i = lower_bound_xz(x, z);
+    int column_x;
+    if (i == n) {
+        column_x = bible_positions[bible_positions_by_xz[n - 1]].x;
+    }
+    else if (i == 0) {
+        column_x = bible_positions[bible_positions_by_xz[0]].x;
+    }
+    else {
+        int right = bible_positions[bible_positions_by_xz[i]].x;
+        int left = bible_positions[bible_positions_by_xz[i - 1]].x;
+        column_x = abs(right - x) < abs(left - x) ? right : left;
+    }
+    // then walk outwards along Z from the nearest verse in that column
+    int hi = lower_bound_xz(column_x, z);
+    int lo = hi - 1;
+    int count = 0;
+    while (count < max_results) {
+        int lo_ok = lo >= 0 &&
+            bible_positions[bible_positions_by_xz[lo]].x == column_x;
+        int hi_ok = hi < n &&
+            bible_positions[bible_positions_by_xz[hi]].x == column_x;
+        if (!lo_ok && !hi_ok) {
+            break;
+        }
+        int index;
+        if (lo_ok && (!hi_ok ||
+            z - bible_positions[bible_positions_by_xz[lo]].z <=
+            bible_positions[bible_positions_by_xz[hi]].z - z))
+        {
+            index = bible_positions_by_xz[lo--];
+        }
+        else {
+            index = bible_positions_by_xz[hi++];
+        }
+        const BiblePosition *p = bible_positions + index;
+        BiblePositionResult *r = results + count++;
+        r->book = bible_books[p->book].name;
+        r->chapter = p->chapter;
+        r->verse = p->verse;
+        r->x = p->x;
+        r->y = p->y;
+        r->z = p->z;
+    }
+    return count;
+}
+
 // ============================================================================
 // DAILY READING PLAN IMPLEMENTATION
 // ============================================================================
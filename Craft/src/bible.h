@@ -147,4 +147,47 @@ int bible_get_chapter_count(const char *book);
 // Returns verse count, or 0 if book/chapter not found
 int bible_get_verse_count(const char *book, int chapter);
 
+// SEARCH FUNCTIONS
+// A single verse matched by bible_search
+typedef struct {
+    const char *book;
+    int chapter;
+    int verse;
+    const char *text;
+} BibleSearchResult;
+
+// Find verses containing every word in query (case-insensitive)
+// Uses the inverted word index built by bible_init
+// Fills up to max_results entries in results
+// Returns the total number of matching verses (may exceed max_results)
+int bible_search(const char *query, BibleSearchResult *results, int max_results);
+
+// VERSE POSITION TABLE
+// A verse location returned by bible_find_nearby
+typedef struct {
+    const char *book;
+    int chapter;
+    int verse;
+    int x, y, z;
+} BiblePositionResult;
+
+// Load all bible_position rows and daily reading offsets from the database
+// Call after db_init; positions recorded during generation are added as well
+// Returns the number of positions loaded
+int bible_load_positions(void);
+
+// Look up a teleport position without touching the database
+// chapter 0, verse 0 = book start; verse 0 = chapter start
+// book "INFO", chapter -1 = info area
+// Returns 1 if found, 0 if not found
+int bible_get_position(
+    const char *book, int chapter, int verse,
+    int *x, int *y, int *z
+);
+
+// Find the verses closest to (x, z) on the nearest book scroll
+// Results are ordered nearest first
+// Returns the number of results filled
+int bible_find_nearby(int x, int z, BiblePositionResult *results, int max_results);
+
 #endif
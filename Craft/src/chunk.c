@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include "chunk.h"
+#include "config.h"
+#include "cube.h"
+#include "item.h"
+#include "noise.h"
+#include "trace.h"
+#include "util.h"
+
+void occlusion(
+    char neighbors[27], char lights[27], float shades[27],
+    float ao[6][4], float light[6][4])
+{
+    static const int lookup3[6][4][3] = {
+        {{0, 1, 3}, {2, 1, 5}, {6, 3, 7}, {8, 5, 7}},
+        {{18, 19, 21}, {20, 19, 23}, {24, 21, 25}, {26, 23, 25}},
+        {{6, 7, 15}, {8, 7, 17}, {24, 15, 25}, {26, 17, 25}},
+        {{0, 1, 9}, {2, 1, 11}, {18, 9, 19}, {20, 11, 19}},
+        {{0, 3, 9}, {6, 3, 15}, {18, 9, 21}, {24, 15, 21}},
+        {{2, 5, 11}, {8, 5, 17}, {20, 11, 23}, {26, 17, 23}}
+    };
+   static const int lookup4[6][4][4] = {
+        {{0, 1, 3, 4}, {1, 2, 4, 5}, {3, 4, 6, 7}, {4, 5, 7, 8}},
+        {{18, 19, 21, 22}, {19, 20, 22, 23}, {21, 22, 24, 25}, {22, 23, 25, 26}},
+        {{6, 7, 15, 16}, {7, 8, 16, 17}, {15, 16, 24, 25}, {16, 17, 25, 26}},
+        {{0, 1, 9, 10}, {1, 2, 10, 11}, {9, 10, 18, 19}, {10, 11, 19, 20}},
+        {{0, 3, 9, 12}, {3, 6, 12, 15}, {9, 12, 18, 21}, {12, 15, 21, 24}},
+        {{2, 5, 11, 14}, {5, 8, 14, 17}, {11, 14, 20, 23}, {14, 17, 23, 26}}
+    };
+    static const float curve[4] = {0.0, 0.25, 0.5, 0.75};
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j < 4; j++) {
+            int corner = neighbors[lookup3[i][j][0]];
+            int side1 = neighbors[lookup3[i][j][1]];
+            int side2 = neighbors[lookup3[i][j][2]];
+            int value = side1 && side2 ? 3 : corner + side1 + side2;
+            float shade_sum = 0;
+            float light_sum = 0;
+            int is_light = lights[13] == 15;
+            for (int k = 0; k < 4; k++) {
+                shade_sum += shades[lookup4[i][j][k]];
+                light_sum += lights[lookup4[i][j][k]];
+            }
+            if (is_light) {
+                light_sum = 15 * 4 * 10;
+            }
+            float total = curve[value] + shade_sum / 4.0;
+            ao[i][j] = MIN(total, 1.0);
+            light[i][j] = light_sum / 15.0 / 4.0;
+        }
+    }
+}
+
+#define XZ_SIZE (CHUNK_SIZE * 3 + 2)
+#define XZ_LO (CHUNK_SIZE)
+#define XZ_HI (CHUNK_SIZE * 2 + 1)
+#define Y_SIZE 258
+#define XYZ(x, y, z) ((y) * XZ_SIZE * XZ_SIZE + (x) * XZ_SIZE + (z))
+#define XZ(x, z) ((x) * XZ_SIZE + (z))
+
+void light_fill(
+    char *opaque, char *light,
+    int x, int y, int z, int w, int force)
+{
+    if (x + w < XZ_LO || z + w < XZ_LO) {
+        return;
+    }
+    if (x - w > XZ_HI || z - w > XZ_HI) {
+        return;
+    }
+    if (y < 0 || y >= Y_SIZE) {
+        return;
+    }
+    if (light[XYZ(x, y, z)] >= w) {
+        return;
+    }
+    if (!force && opaque[XYZ(x, y, z)]) {
+        return;
+    }
+    light[XYZ(x, y, z)] = w--;
+    light_fill(opaque, light, x - 1, y, z, w, 0);
+    light_fill(opaque, light, x + 1, y, z, w, 0);
+    light_fill(opaque, light, x, y - 1, z, w, 0);
+    light_fill(opaque, light, x, y + 1, z, w, 0);
+    light_fill(opaque, light, x, y, z - 1, w, 0);
+    light_fill(opaque, light, x, y, z + 1, w, 0);
+}
+
+// Worker jobs are cancelled by the main thread (see cancel_stale_jobs) and
+// checked between phases; synchronous jobs have no mutex and never cancel.
+int item_cancelled(WorkerItem *item) {
+    if (!item->mtx) {
+        return 0;
+    }
+    mtx_lock(item->mtx);
+    int cancelled = item->cancelled;
+    mtx_unlock(item->mtx);
+    return cancelled;
+}
+
+void compute_chunk(WorkerItem *item) {
+    item->data = 0;
+    if (item_cancelled(item)) {
+        return;
+    }
+    char *opaque = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
+    char *light = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
+    char *highest = (char *)calloc(XZ_SIZE * XZ_SIZE, sizeof(char));
+
+    int ox = item->p * CHUNK_SIZE - CHUNK_SIZE - 1;
+    int oy = -1;
+    int oz = item->q * CHUNK_SIZE - CHUNK_SIZE - 1;
+
+    // check for lights
+    int has_light = 0;
+    if (SHOW_LIGHTS) {
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) {
+                Map *map = item->light_maps[a][b];
+                if (map && map->size) {
+                    has_light = 1;
+                }
+            }
+        }
+    }
+
+    // populate opaque array, each block from the chunk that owns it; the
+    // padding a chunk keeps around its edges only stands in for neighbours
+    // that are not loaded
+    trace_begin("opaque");
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            Map *map = item->block_maps[a][b];
+            if (!map) {
+                continue;
+            }
+            MAP_FOR_EACH(map, ex, ey, ez, ew) {
+                int x = ex - ox;
+                int y = ey - oy;
+                int z = ez - oz;
+                int w = ew;
+                if (x < 1 || y < 0 || z < 1) {
+                    continue;
+                }
+                if (x >= XZ_SIZE - 1 || y >= Y_SIZE || z >= XZ_SIZE - 1) {
+                    continue;
+                }
+                int owner_a = (x - 1) / CHUNK_SIZE;
+                int owner_b = (z - 1) / CHUNK_SIZE;
+                if (owner_a != a || owner_b != b) {
+                    if (a != 1 || b != 1) {
+                        continue;
+                    }
+                    if (item->block_maps[owner_a][owner_b]) {
+                        continue;
+                    }
+                }
+                opaque[XYZ(x, y, z)] = !is_transparent(w);
+                if (opaque[XYZ(x, y, z)]) {
+                    highest[XZ(x, z)] = MAX(highest[XZ(x, z)], y);
+                }
+            } END_MAP_FOR_EACH;
+        }
+    }
+    trace_end("opaque");
+
+    if (item_cancelled(item)) {
+        free(opaque);
+        free(light);
+        free(highest);
+        return;
+    }
+
+    // flood fill light intensities
+    if (has_light) {
+        trace_begin("light");
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) {
+                Map *map = item->light_maps[a][b];
+                if (!map) {
+                    continue;
+                }
+                MAP_FOR_EACH(map, ex, ey, ez, ew) {
+                    int x = ex - ox;
+                    int y = ey - oy;
+                    int z = ez - oz;
+                    light_fill(opaque, light, x, y, z, ew, 1);
+                } END_MAP_FOR_EACH;
+            }
+        }
+        trace_end("light");
+    }
+
+    Map *map = item->block_maps[1][1];
+
+    if (has_light && item_cancelled(item)) {
+        free(opaque);
+        free(light);
+        free(highest);
+        return;
+    }
+
+    // count exposed faces
+    trace_begin("count_faces");
+    int miny = 256;
+    int maxy = 0;
+    int faces = 0;
+    int transparent_faces = 0;
+    MAP_FOR_EACH(map, ex, ey, ez, ew) {
+        if (ew <= 0) {
+            continue;
+        }
+        int x = ex - ox;
+        int y = ey - oy;
+        int z = ez - oz;
+        int f1 = !opaque[XYZ(x - 1, y, z)];
+        int f2 = !opaque[XYZ(x + 1, y, z)];
+        int f3 = !opaque[XYZ(x, y + 1, z)];
+        int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
+        int f5 = !opaque[XYZ(x, y, z - 1)];
+        int f6 = !opaque[XYZ(x, y, z + 1)];
+        int total = f1 + f2 + f3 + f4 + f5 + f6;
+        if (total == 0) {
+            continue;
+        }
+        if (is_plant(ew)) {
+            total = 4;
+        }
+        miny = MIN(miny, ey);
+        maxy = MAX(maxy, ey);
+        faces += total;
+        if (is_transparent(ew)) {
+            transparent_faces += total;
+        }
+    } END_MAP_FOR_EACH;
+    trace_end("count_faces");
+
+    if (item_cancelled(item)) {
+        free(opaque);
+        free(light);
+        free(highest);
+        return;
+    }
+
+    // generate geometry, opaque blocks first and alpha tested ones
+    // (glass, leaves, plants) after them so they can be drawn separately
+    trace_begin("geometry");
+    GLfloat *data = malloc_faces(10, faces);
+    int opaque_offset = 0;
+    int transparent_offset = (faces - transparent_faces) * 60;
+    MAP_FOR_EACH(map, ex, ey, ez, ew) {
+        if (ew <= 0) {
+            continue;
+        }
+        int x = ex - ox;
+        int y = ey - oy;
+        int z = ez - oz;
+        int f1 = !opaque[XYZ(x - 1, y, z)];
+        int f2 = !opaque[XYZ(x + 1, y, z)];
+        int f3 = !opaque[XYZ(x, y + 1, z)];
+        int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
+        int f5 = !opaque[XYZ(x, y, z - 1)];
+        int f6 = !opaque[XYZ(x, y, z + 1)];
+        int total = f1 + f2 + f3 + f4 + f5 + f6;
+        if (total == 0) {
+            continue;
+        }
+        char neighbors[27] = {0};
+        char lights[27] = {0};
+        float shades[27] = {0};
+        int index = 0;
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dz = -1; dz <= 1; dz++) {
+                    neighbors[index] = opaque[XYZ(x + dx, y + dy, z + dz)];
+                    lights[index] = light[XYZ(x + dx, y + dy, z + dz)];
+                    shades[index] = 0;
+                    if (y + dy <= highest[XZ(x + dx, z + dz)]) {
+                        for (int oy = 0; oy < 8; oy++) {
+                            if (opaque[XYZ(x + dx, y + dy + oy, z + dz)]) {
+                                shades[index] = 1.0 - oy * 0.125;
+                                break;
+                            }
+                        }
+                    }
+                    index++;
+                }
+            }
+        }
+        float ao[6][4];
+        float light[6][4];
+        occlusion(neighbors, lights, shades, ao, light);
+        int *offset = is_transparent(ew) ?
+            &transparent_offset : &opaque_offset;
+        if (is_plant(ew)) {
+            total = 4;
+            float min_ao = 1;
+            float max_light = 0;
+            for (int a = 0; a < 6; a++) {
+                for (int b = 0; b < 4; b++) {
+                    min_ao = MIN(min_ao, ao[a][b]);
+                    max_light = MAX(max_light, light[a][b]);
+                }
+            }
+            float rotation = simplex2(ex, ez, 4, 0.5, 2) * 360;
+            make_plant(
+                data + *offset, min_ao, max_light,
+                ex, ey, ez, 0.5, ew, rotation);
+        }
+        else {
+            make_cube(
+                data + *offset, ao, light,
+                f1, f2, f3, f4, f5, f6,
+                ex, ey, ez, 0.5, ew);
+        }
+        *offset += total * 60;
+    } END_MAP_FOR_EACH;
+    trace_end("geometry");
+
+    free(opaque);
+    free(light);
+    free(highest);
+
+    item->miny = miny;
+    item->maxy = maxy;
+    item->faces = faces;
+    item->transparent_faces = transparent_faces;
+    item->data = data;
+}
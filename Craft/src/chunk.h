@@ -0,0 +1,34 @@
+#ifndef _chunk_h_
+#define _chunk_h_
+
+#include <GL/glew.h>
+#include "map.h"
+#include "tinycthread.h"
+
+typedef struct {
+    int p;
+    int q;
+    int load;
+    int edges;
+    Map *block_maps[3][3];
+    Map *light_maps[3][3];
+    int miny;
+    int maxy;
+    int faces;
+    int transparent_faces;
+    int generation;
+    int cancelled;
+    mtx_t *mtx;
+    GLfloat *data;
+} WorkerItem;
+
+void occlusion(
+    char neighbors[27], char lights[27], float shades[27],
+    float ao[6][4], float light[6][4]);
+void light_fill(
+    char *opaque, char *light,
+    int x, int y, int z, int w, int force);
+int item_cancelled(WorkerItem *item);
+void compute_chunk(WorkerItem *item);
+
+#endif
@@ -3,6 +3,7 @@
     #include <windows.h>
     #define close closesocket
     #define sleep Sleep
+    #define SHUT_RDWR SD_BOTH
 #else
     #include <netdb.h>
     #include <unistd.h>
@@ -13,38 +14,108 @@
 #include <string.h>
 #include "client.h"
 #include "tinycthread.h"
+#include "trace.h"
 
 #define QUEUE_SIZE 1048576
+#define QUEUE_MASK (QUEUE_SIZE - 1)
 #define RECV_SIZE 4096
+#define MAX_PACKET_SIZE (QUEUE_SIZE / 2)
+#define CHUNK_BATCH 64
 
-typedef struct {
+// The receive thread writes straight into a single-producer,
+// single-consumer byte ring and publishes head; the main thread hands out
+// lines in place and publishes tail once it is done with them. The mutex
+// and condition variable are only used when the ring is full.
+//
+// Outgoing messages are appended to a buffer that the send thread takes
+// whole and writes with as few send() calls as it can, so the main thread
+// never waits on the socket. Only the latest position is kept and it goes
+// out with the next batch.
+struct Client {
     int enabled;
+    int binary;
     int running;
+    int started;
     int sd;
     int bytes_sent;
     int bytes_received;
     char *queue;
-    int qsize;
+    unsigned int head;
+    unsigned int tail;
+    unsigned int scan;
+    unsigned int next;
+    int waiting;
+    char *line;
+    int line_capacity;
+    char *out;
+    int out_size;
+    int out_capacity;
+    int sending;
+    int has_position;
+    float position[5];
+    float last_position[5];
     thrd_t recv_thread;
+    thrd_t send_thread;
     mtx_t mutex;
-} Client;
+    cnd_t cnd;
+    mtx_t send_mutex;
+    cnd_t send_cnd;
+};
 
-static Client client = {0};
+static Client main_client = {0};
+static _Thread_local Client *client = &main_client;
+
+// The game uses a single connection. Tools that open several, like the
+// load generator, create one per thread and select it there; the
+// receive and send threads select the connection that started them.
+Client *client_create() {
+    return (Client *)calloc(1, sizeof(Client));
+}
+
+// Stops the connection first if its threads are still around, as they are
+// for one that was dropped by the server.
+void client_destroy(Client *connection) {
+    Client *previous = client;
+    client = connection;
+    client_stop();
+    client = previous == connection ? &main_client : previous;
+    free(connection);
+}
+
+void client_select(Client *connection) {
+    client = connection ? connection : &main_client;
+}
+
+void get_client_bytes(int *sent, int *received) {
+    *sent = client->bytes_sent;
+    *received = client->bytes_received;
+}
 
 void client_enable() {
-    client.enabled = 1;
+    client->enabled = 1;
 }
 
 void client_disable() {
-    client.enabled = 0;
+    client->enabled = 0;
 }
 
 int get_client_enabled() {
-    return client.enabled;
+    return client->enabled;
+}
+
+// Switches the receive side to binary packets once the server has
+// acknowledged version 2. Everything up to the acknowledgement is text.
+void client_enable_binary() {
+    client->binary = 1;
+    client->scan = client->next;
+}
+
+int get_client_binary() {
+    return client->binary;
 }
 
 int client_sendall(int sd, char *data, int length) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return 0;
     }
     int count = 0;
@@ -55,24 +126,36 @@ int client_sendall(int sd, char *data, int length) {
         }
         count += n;
         length -= n;
-        client.bytes_sent += n;
+        client->bytes_sent += n;
     }
     return 0;
 }
 
+// Call with send_mutex held.
+static void client_append(const char *data, int length) {
+    if (client->out_size + length > client->out_capacity) {
+        client->out_capacity *= 2;
+        if (client->out_capacity < client->out_size + length) {
+            client->out_capacity = client->out_size + length;
+        }
+        client->out = realloc(client->out, client->out_capacity);
+    }
+    memcpy(client->out + client->out_size, data, length);
+    client->out_size += length;
+}
+
 void client_send(char *data) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return;
     }
-    if (client_sendall(client.sd, data, strlen(data)) == -1) {
-        perror("client_send failed");
-        fprintf(stderr, "Network error - disabling client\n");
-        client_disable();
-    }
+    mtx_lock(&client->send_mutex);
+    client_append(data, strlen(data));
+    cnd_signal(&client->send_cnd);
+    mtx_unlock(&client->send_mutex);
 }
 
 void client_version(int version) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return;
     }
     char buffer[1024];
@@ -81,7 +164,7 @@ void client_version(int version) {
 }
 
 void client_login(const char *username, const char *identity_token) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return;
     }
     char buffer[1024];
@@ -90,27 +173,34 @@ void client_login(const char *username, const char *identity_token) {
 }
 
 void client_position(float x, float y, float z, float rx, float ry) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return;
     }
-    static float px, py, pz, prx, pry = 0;
+    float *p = client->last_position;
     float distance =
-        (px - x) * (px - x) +
-        (py - y) * (py - y) +
-        (pz - z) * (pz - z) +
-        (prx - rx) * (prx - rx) +
-        (pry - ry) * (pry - ry);
+        (p[0] - x) * (p[0] - x) +
+        (p[1] - y) * (p[1] - y) +
+        (p[2] - z) * (p[2] - z) +
+        (p[3] - rx) * (p[3] - rx) +
+        (p[4] - ry) * (p[4] - ry);
     if (distance < 0.0001) {
         return;
     }
-    px = x; py = y; pz = z; prx = rx; pry = ry;
-    char buffer[1024];
-    snprintf(buffer, 1024, "P,%.2f,%.2f,%.2f,%.2f,%.2f\n", x, y, z, rx, ry);
-    client_send(buffer);
+    p[0] = x; p[1] = y; p[2] = z; p[3] = rx; p[4] = ry;
+    // replaces a position that has not been sent yet
+    mtx_lock(&client->send_mutex);
+    client->position[0] = x;
+    client->position[1] = y;
+    client->position[2] = z;
+    client->position[3] = rx;
+    client->position[4] = ry;
+    client->has_position = 1;
+    cnd_signal(&client->send_cnd);
+    mtx_unlock(&client->send_mutex);
 }
 
 void client_chunk(int p, int q, int key) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return;
     }
     char buffer[1024];
@@ -118,8 +208,34 @@ void client_chunk(int p, int q, int key) {
     client_send(buffer);
 }
 
+// Asks for several chunks, data holding p, q and key for each. Servers
+// that acknowledged version 2 take up to CHUNK_BATCH chunks per message and
+// answer in that order; older servers get a message per chunk.
+void client_chunks(const int *data, int count) {
+    if (!client->enabled) {
+        return;
+    }
+    if (!client->binary) {
+        for (int i = 0; i < count; i++) {
+            client_chunk(data[i * 3], data[i * 3 + 1], data[i * 3 + 2]);
+        }
+        return;
+    }
+    char buffer[CHUNK_BATCH * 40 + 8];
+    for (int i = 0; i < count; i += CHUNK_BATCH) {
+        int n = count - i < CHUNK_BATCH ? count - i : CHUNK_BATCH;
+        int length = snprintf(buffer, sizeof(buffer), "C");
+        for (int j = i; j < i + n; j++) {
+            length += snprintf(buffer + length, sizeof(buffer) - length,
+                ",%d,%d,%d", data[j * 3], data[j * 3 + 1], data[j * 3 + 2]);
+        }
+        snprintf(buffer + length, sizeof(buffer) - length, "\n");
+        client_send(buffer);
+    }
+}
+
 void client_block(int x, int y, int z, int w) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return;
     }
     char buffer[1024];
@@ -128,7 +244,7 @@ void client_block(int x, int y, int z, int w) {
 }
 
 void client_light(int x, int y, int z, int w) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return;
     }
     char buffer[1024];
@@ -137,7 +253,7 @@ void client_light(int x, int y, int z, int w) {
 }
 
 void client_sign(int x, int y, int z, int face, const char *text) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return;
     }
     char buffer[1024];
@@ -146,7 +262,7 @@ void client_sign(int x, int y, int z, int face, const char *text) {
 }
 
 void client_talk(const char *text) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return;
     }
     if (strlen(text) == 0) {
@@ -157,36 +273,162 @@ void client_talk(const char *text) {
     client_send(buffer);
 }
 
-char *client_recv() {
-    if (!client.enabled) {
+static void client_release(unsigned int position) {
+    if (client->tail == position) {
+        return;
+    }
+    __atomic_store_n(&client->tail, position, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&client->waiting, 0, __ATOMIC_SEQ_CST)) {
+        mtx_lock(&client->mutex);
+        cnd_signal(&client->cnd);
+        mtx_unlock(&client->mutex);
+    }
+}
+
+static char *client_copy(unsigned int start, unsigned int length) {
+    if (client->line_capacity < (int)length + 1) {
+        client->line_capacity = length + 1;
+        client->line = realloc(client->line, client->line_capacity);
+    }
+    unsigned int offset = start & QUEUE_MASK;
+    unsigned int first = QUEUE_SIZE - offset;
+    memcpy(client->line, client->queue + offset, first);
+    memcpy(client->line + first, client->queue, length - first);
+    client->line[length] = '\0';
+    return client->line;
+}
+
+// Returns the next complete line without its newline, or 0 if none has
+// arrived yet. The line points into the ring and stays valid until the
+// next call. Bytes already searched are not searched again.
+char *client_recv_line() {
+    if (!client->enabled) {
+        return 0;
+    }
+    client_release(client->next);
+    unsigned int start = client->tail;
+    unsigned int head = __atomic_load_n(&client->head, __ATOMIC_ACQUIRE);
+    char *end = 0;
+    while (!end && client->scan != head) {
+        unsigned int offset = client->scan & QUEUE_MASK;
+        unsigned int size = head - client->scan;
+        if (size > QUEUE_SIZE - offset) {
+            size = QUEUE_SIZE - offset;
+        }
+        end = memchr(client->queue + offset, '\n', size);
+        client->scan += end ? end - (client->queue + offset) : size;
+    }
+    if (!end) {
+        return 0;
+    }
+    unsigned int length = client->scan - start;
+    client->scan++;
+    client->next = client->scan;
+    client->bytes_received += length + 1;
+    unsigned int offset = start & QUEUE_MASK;
+    if (offset + length < QUEUE_SIZE) {
+        *end = '\0';
+        return client->queue + offset;
+    }
+    // the line wraps around the end of the ring
+    return client_copy(start, length);
+}
+
+// Returns the next complete binary packet, a type byte followed by the
+// payload, or 0 if none has arrived yet. Each packet is prefixed with its
+// length as a varint. Like lines, packets are handed out in place unless
+// they wrap around the end of the ring.
+char *client_recv_packet(int *length) {
+    if (!client->enabled) {
+        return 0;
+    }
+    client_release(client->next);
+    unsigned int start = client->tail;
+    unsigned int head = __atomic_load_n(&client->head, __ATOMIC_ACQUIRE);
+    unsigned int position = start;
+    unsigned int size = 0;
+    for (int shift = 0; ; shift += 7) {
+        if (position == head) {
+            return 0;
+        }
+        unsigned char c = client->queue[position++ & QUEUE_MASK];
+        size |= (unsigned int)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            break;
+        }
+        if (shift == 28) {
+            size = MAX_PACKET_SIZE;
+            break;
+        }
+    }
+    if (size == 0 || size >= MAX_PACKET_SIZE) {
+        // the stream cannot be resynchronized after a bad length
+        fprintf(stderr, "Bad packet from server - disabling client\n");
+        client_disable();
+        return 0;
+    }
+    if (head - position < size) {
         return 0;
     }
-    char *result = 0;
-    mtx_lock(&client.mutex);
-    char *p = client.queue + client.qsize - 1;
-    while (p >= client.queue && *p != '\n') {
-        p--;
+    client->next = client->scan = position + size;
+    client->bytes_received += client->next - start;
+    *length = size;
+    unsigned int offset = position & QUEUE_MASK;
+    if (offset + size <= QUEUE_SIZE) {
+        return client->queue + offset;
+    }
+    return client_copy(position, size);
+}
+
+// Hands the message returned last out again on the next call.
+void client_unread() {
+    client->bytes_received -= client->next - client->tail;
+    client->next = client->scan = client->tail;
+}
+
+// Blocks while the ring is full so the socket stops being read and the
+// server sees TCP backpressure. Returns the free space, or 0 when the
+// client is stopping.
+static unsigned int client_wait_space() {
+    unsigned int head = client->head;
+    unsigned int space =
+        QUEUE_SIZE - (head - __atomic_load_n(&client->tail, __ATOMIC_SEQ_CST));
+    if (space >= RECV_SIZE) {
+        return space;
     }
-    if (p >= client.queue) {
-        int length = p - client.queue + 1;
-        result = malloc(sizeof(char) * (length + 1));
-        memcpy(result, client.queue, sizeof(char) * length);
-        result[length] = '\0';
-        int remaining = client.qsize - length;
-        memmove(client.queue, p + 1, remaining);
-        client.qsize -= length;
-        client.bytes_received += length;
+    mtx_lock(&client->mutex);
+    while (__atomic_load_n(&client->running, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&client->waiting, 1, __ATOMIC_SEQ_CST);
+        space = QUEUE_SIZE -
+            (head - __atomic_load_n(&client->tail, __ATOMIC_SEQ_CST));
+        if (space >= RECV_SIZE) {
+            break;
+        }
+        cnd_wait(&client->cnd, &client->mutex);
     }
-    mtx_unlock(&client.mutex);
-    return result;
+    __atomic_store_n(&client->waiting, 0, __ATOMIC_SEQ_CST);
+    mtx_unlock(&client->mutex);
+    return __atomic_load_n(&client->running, __ATOMIC_SEQ_CST) ? space : 0;
 }
 
 int recv_worker(void *arg) {
-    char *data = malloc(sizeof(char) * RECV_SIZE);
+    client = (Client *)arg;
+    trace_thread("recv");
     while (1) {
+        trace_begin("wait");
+        unsigned int space = client_wait_space();
+        trace_end("wait");
+        if (!space) {
+            break;
+        }
+        unsigned int head = client->head;
+        unsigned int offset = head & QUEUE_MASK;
+        if (space > QUEUE_SIZE - offset) {
+            space = QUEUE_SIZE - offset;
+        }
         int length;
-        if ((length = recv(client.sd, data, RECV_SIZE - 1, 0)) <= 0) {
-            if (client.running) {
+        if ((length = recv(client->sd, client->queue + offset, space, 0)) <= 0) {
+            if (__atomic_load_n(&client->running, __ATOMIC_SEQ_CST)) {
                 perror("recv failed");
                 fprintf(stderr, "Connection lost - disabling client\n");
                 client_disable();
@@ -196,20 +438,54 @@ int recv_worker(void *arg) {
                 break;
             }
         }
-        data[length] = '\0';
-        while (1) {
-            int done = 0;
-            mtx_lock(&client.mutex);
-            if (client.qsize + length < QUEUE_SIZE) {
-                memcpy(client.queue + client.qsize, data, sizeof(char) * (length + 1));
-                client.qsize += length;
-                done = 1;
-            }
-            mtx_unlock(&client.mutex);
-            if (done) {
-                break;
-            }
-            sleep(0);
+        __atomic_store_n(&client->head, head + length, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// Sends everything queued since the last write in one go. When the
+// client stops, whatever is still queued is sent before the thread exits.
+int send_worker(void *arg) {
+    client = (Client *)arg;
+    trace_thread("send");
+    char *data = 0;
+    int capacity = 0;
+    while (1) {
+        mtx_lock(&client->send_mutex);
+        while (!client->out_size && !client->has_position &&
+            __atomic_load_n(&client->running, __ATOMIC_SEQ_CST))
+        {
+            cnd_wait(&client->send_cnd, &client->send_mutex);
+        }
+        if (client->has_position) {
+            char buffer[256];
+            float *v = client->position;
+            int length = snprintf(buffer, sizeof(buffer),
+                "P,%.2f,%.2f,%.2f,%.2f,%.2f\n", v[0], v[1], v[2], v[3], v[4]);
+            client_append(buffer, length);
+            client->has_position = 0;
+        }
+        // swap buffers so the main thread can keep appending
+        char *out = client->out;
+        int out_capacity = client->out_capacity;
+        int size = client->out_size;
+        client->out = data;
+        client->out_capacity = capacity;
+        client->out_size = 0;
+        data = out;
+        capacity = out_capacity;
+        mtx_unlock(&client->send_mutex);
+        if (!size) {
+            break;
+        }
+        trace_begin("send");
+        int result = client_sendall(client->sd, data, size);
+        trace_end("send");
+        if (result == -1) {
+            perror("client_send failed");
+            fprintf(stderr, "Network error - disabling client\n");
+            client_disable();
+            break;
         }
     }
     free(data);
@@ -217,7 +493,7 @@ int recv_worker(void *arg) {
 }
 
 int client_connect(char *hostname, int port) {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return -1;
     }
     struct hostent *host;
@@ -231,12 +507,12 @@ int client_connect(char *hostname, int port) {
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = ((struct in_addr *)(host->h_addr_list[0]))->s_addr;
     address.sin_port = htons(port);
-    if ((client.sd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+    if ((client->sd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
         perror("socket");
         client_disable();
         return -1;
     }
-    if (connect(client.sd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+    if (connect(client->sd, (struct sockaddr *)&address, sizeof(address)) == -1) {
         perror("connect");
         client_disable();
         return -1;
@@ -245,40 +521,87 @@ int client_connect(char *hostname, int port) {
 }
 
 int client_start() {
-    if (!client.enabled) {
+    if (!client->enabled) {
         return -1;
     }
-    client.running = 1;
-    client.queue = (char *)calloc(QUEUE_SIZE, sizeof(char));
-    if (!client.queue) {
+    client->running = 1;
+    client->queue = (char *)calloc(QUEUE_SIZE, sizeof(char));
+    if (!client->queue) {
         perror("calloc failed");
         client_disable();
         return -1;
     }
-    client.qsize = 0;
-    mtx_init(&client.mutex, mtx_plain);
-    if (thrd_create(&client.recv_thread, recv_worker, NULL) != thrd_success) {
+    client->binary = 0;
+    client->head = 0;
+    client->tail = 0;
+    client->scan = 0;
+    client->next = 0;
+    client->waiting = 0;
+    client->out_size = 0;
+    client->has_position = 0;
+    mtx_init(&client->mutex, mtx_plain);
+    cnd_init(&client->cnd);
+    mtx_init(&client->send_mutex, mtx_plain);
+    cnd_init(&client->send_cnd);
+    if (thrd_create(&client->recv_thread, recv_worker, client) != thrd_success) {
+        perror("thrd_create");
+        free(client->queue);
+        client->queue = NULL;
+        cnd_destroy(&client->send_cnd);
+        mtx_destroy(&client->send_mutex);
+        cnd_destroy(&client->cnd);
+        mtx_destroy(&client->mutex);
+        client_disable();
+        return -1;
+    }
+    client->started = 1;
+    if (thrd_create(&client->send_thread, send_worker, client) != thrd_success) {
         perror("thrd_create");
-        free(client.queue);
-        client.queue = NULL;
-        mtx_destroy(&client.mutex);
+        client_stop();
         client_disable();
         return -1;
     }
+    client->sending = 1;
     return 0;
 }
 
+// Tears down a started connection even if it has been disabled since,
+// which the receive and send threads do when the socket fails.
 void client_stop() {
-    if (!client.enabled) {
+    if (!client->started) {
         return;
     }
-    client.running = 0;
-    close(client.sd);
-    if (thrd_join(client.recv_thread, NULL) != thrd_success) {
+    client->started = 0;
+    __atomic_store_n(&client->running, 0, __ATOMIC_SEQ_CST);
+    if (client->sending) {
+        // let the send thread write out what is still queued
+        mtx_lock(&client->send_mutex);
+        cnd_signal(&client->send_cnd);
+        mtx_unlock(&client->send_mutex);
+        if (thrd_join(client->send_thread, NULL) != thrd_success) {
+            perror("thrd_join");
+        }
+        client->sending = 0;
+    }
+    // close alone does not wake a thread blocked in recv
+    shutdown(client->sd, SHUT_RDWR);
+    close(client->sd);
+    mtx_lock(&client->mutex);
+    cnd_signal(&client->cnd);
+    mtx_unlock(&client->mutex);
+    if (thrd_join(client->recv_thread, NULL) != thrd_success) {
         perror("thrd_join");
     }
-    mtx_destroy(&client.mutex);
-    client.qsize = 0;
-    free(client.queue);
-    client.queue = NULL;
+    cnd_destroy(&client->cnd);
+    mtx_destroy(&client->mutex);
+    cnd_destroy(&client->send_cnd);
+    mtx_destroy(&client->send_mutex);
+    free(client->queue);
+    client->queue = NULL;
+    free(client->out);
+    client->out = NULL;
+    client->out_capacity = 0;
+    free(client->line);
+    client->line = NULL;
+    client->line_capacity = 0;
 }
@@ -3,18 +3,30 @@
 
 #define DEFAULT_PORT 4080
 
+typedef struct Client Client;
+
+Client *client_create();
+void client_destroy(Client *connection);
+void client_select(Client *connection);
+void get_client_bytes(int *sent, int *received);
+
 void client_enable();
 void client_disable();
 int get_client_enabled();
+void client_enable_binary();
+int get_client_binary();
 int client_connect(char *hostname, int port);
 int client_start();
 void client_stop();
 void client_send(char *data);
-char *client_recv();
+char *client_recv_line();
+char *client_recv_packet(int *length);
+void client_unread();
 void client_version(int version);
 void client_login(const char *username, const char *identity_token);
 void client_position(float x, float y, float z, float rx, float ry);
 void client_chunk(int p, int q, int key);
+void client_chunks(const int *data, int count);
 void client_block(int x, int y, int z, int w);
 void client_light(int x, int y, int z, int w);
 void client_sign(int x, int y, int z, int face, const char *text);
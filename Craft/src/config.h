@@ -26,6 +26,7 @@
 #define SHOW_CHAT_TEXT 1
 #define SHOW_PLAYER_NAMES 1
 #define SHOW_FOG 0              // Set to 0 for Bible viewing (clearer text at distance)
+#define OCCLUSION_CULLING 1     // Skip chunks hidden behind other geometry (GL occlusion queries)
 
 // world generation options
 #define FLATLANDS 1             // 1 = flat world for Bible viewing, 0 = normal terrain
@@ -71,5 +72,13 @@
 #define DELETE_CHUNK_RADIUS 14   // Reduced for Bible viewing (448 block radius)
 #define CHUNK_SIZE 32
 #define COMMIT_INTERVAL 5
+#define TELEPORT_TIMEOUT 3.0     // Max seconds to wait for destination chunks
+#define PREFETCH_SECONDS 4.0     // Load chunks this far ahead along the flight path
+#define PREFETCH_RADIUS 2        // Chunk radius around the predicted path to prefetch
+#define OCCLUSION_INTERVAL 8     // Frames between re-checks of chunks that were visible
+#define UPLOAD_BUDGET_BYTES (4 << 20) // Max chunk mesh bytes uploaded to the GPU per frame
+#define UPLOAD_BUDGET_MS 2.0     // Max milliseconds per frame spent uploading chunk meshes
+#define PARSE_BUDGET_MS 4.0      // Max milliseconds per frame spent handling server messages
+#define BINARY_PROTOCOL 1        // Ask the server for binary packets instead of text lines
 
 #endif
@@ -213,6 +213,30 @@ void make_cube_wireframe(float *data, float x, float y, float z, float n) {
     }
 }
 
+void make_box(
+    float *data,
+    float x0, float y0, float z0, float x1, float y1, float z1)
+{
+    float x[2] = {x0, x1};
+    float y[2] = {y0, y1};
+    float z[2] = {z0, z1};
+    static const int indices[36] = {
+        0, 1, 3, 0, 3, 2,
+        4, 6, 7, 4, 7, 5,
+        0, 4, 5, 0, 5, 1,
+        2, 3, 7, 2, 7, 6,
+        0, 2, 6, 0, 6, 4,
+        1, 5, 7, 1, 7, 3
+    };
+    float *d = data;
+    for (int i = 0; i < 36; i++) {
+        int j = indices[i];
+        *(d++) = x[(j >> 2) & 1];
+        *(d++) = y[(j >> 1) & 1];
+        *(d++) = z[j & 1];
+    }
+}
+
 void make_character(
     float *data,
     float x, float y, float n, float m, char c)
@@ -1,7 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "config.h"
 #include "db.h"
 #include "ring.h"
+#include "trace.h"
 #include "sqlite3.h"
 #include "tinycthread.h"
 
@@ -391,6 +394,19 @@ void _db_insert_block(int p, int q, int x, int y, int z, int w) {
     sqlite3_step(insert_block_stmt);
 }
 
+// Stores a whole chunk's worth of blocks with a single queue entry. Takes
+// ownership of data, x, y, z, w for each block.
+void db_insert_blocks(int p, int q, int *data, int count) {
+    if (!db_enabled) {
+        free(data);
+        return;
+    }
+    mtx_lock(&mtx);
+    ring_put_blocks(&ring, BLOCKS, p, q, data, count);
+    cnd_signal(&cnd);
+    mtx_unlock(&mtx);
+}
+
 void db_insert_light(int p, int q, int x, int y, int z, int w) {
     if (!db_enabled) {
         return;
@@ -412,6 +428,17 @@ void _db_insert_light(int p, int q, int x, int y, int z, int w) {
     sqlite3_step(insert_light_stmt);
 }
 
+void db_insert_lights(int p, int q, int *data, int count) {
+    if (!db_enabled) {
+        free(data);
+        return;
+    }
+    mtx_lock(&mtx);
+    ring_put_blocks(&ring, LIGHTS, p, q, data, count);
+    cnd_signal(&cnd);
+    mtx_unlock(&mtx);
+}
+
 void db_insert_sign(
     int p, int q, int x, int y, int z, int face, const char *text)
 {
@@ -459,10 +486,14 @@ void db_delete_all_signs() {
     sqlite3_exec(db, "delete from sign;", NULL, NULL, NULL);
 }
 
-void db_load_blocks(Map *map, int p, int q) {
+// Returns which neighbouring chunks share a border with an edited block, one
+// bit per (dp + 1) * 3 + (dq + 1), as only those see the edits when meshed.
+int db_load_blocks(Map *map, int p, int q) {
     if (!db_enabled) {
-        return;
+        return 0;
     }
+    int edges = 0;
+    trace_begin("db_load_blocks");
     mtx_lock(&load_mtx);
     sqlite3_reset(load_blocks_stmt);
     sqlite3_bind_int(load_blocks_stmt, 1, p);
@@ -473,14 +504,29 @@ void db_load_blocks(Map *map, int p, int q) {
         int z = sqlite3_column_int(load_blocks_stmt, 2);
         int w = sqlite3_column_int(load_blocks_stmt, 3);
         map_set(map, x, y, z, w);
-    }
+        int lx = x - p * CHUNK_SIZE;
+        int lz = z - q * CHUNK_SIZE;
+        if (lx < 0 || lx >= CHUNK_SIZE || lz < 0 || lz >= CHUNK_SIZE) {
+            continue;
+        }
+        int dp = lx == 0 ? -1 : (lx == CHUNK_SIZE - 1 ? 1 : 0);
+        int dq = lz == 0 ? -1 : (lz == CHUNK_SIZE - 1 ? 1 : 0);
+        // the neighbours across each side it touches, and across a corner
+        edges |= 1 << ((dp + 1) * 3 + 1);
+        edges |= 1 << (4 + dq);
+        edges |= 1 << ((dp + 1) * 3 + (dq + 1));
+    }
+    edges &= ~(1 << 4);
     mtx_unlock(&load_mtx);
+    trace_end("db_load_blocks");
+    return edges;
 }
 
 void db_load_lights(Map *map, int p, int q) {
     if (!db_enabled) {
         return;
     }
+    trace_begin("db_load_lights");
     mtx_lock(&load_mtx);
     sqlite3_reset(load_lights_stmt);
     sqlite3_bind_int(load_lights_stmt, 1, p);
@@ -493,6 +539,7 @@ void db_load_lights(Map *map, int p, int q) {
         map_set(map, x, y, z, w);
     }
     mtx_unlock(&load_mtx);
+    trace_end("db_load_lights");
 }
 
 void db_load_signs(SignList *list, int p, int q) {
@@ -622,6 +669,35 @@ int db_get_bible_position(const char *book, int chapter, int verse, int *x, int
     return 0;
 }
 
+int db_load_bible_positions(
+    void (*func)(const char *book, int chapter, int verse, int x, int y, int z))
+{
+    if (!db_enabled) {
+        return 0;
+    }
+    static const char *query =
+        "select book, chapter, verse, x, y, z from bible_position "
+        "order by book, chapter, verse;";
+    sqlite3_stmt *stmt;
+    int count = 0;
+    mtx_lock(&load_mtx);
+    if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char *book = (const char *)sqlite3_column_text(stmt, 0);
+            int chapter = sqlite3_column_int(stmt, 1);
+            int verse = sqlite3_column_int(stmt, 2);
+            int x = sqlite3_column_int(stmt, 3);
+            int y = sqlite3_column_int(stmt, 4);
+            int z = sqlite3_column_int(stmt, 5);
+            func(book, chapter, verse, x, y, z);
+            count++;
+        }
+        sqlite3_finalize(stmt);
+    }
+    mtx_unlock(&load_mtx);
+    return count;
+}
+
 void db_insert_daily_reading_block(int x, int y, int z, const char *date) {
     if (!db_enabled) {
         return;
@@ -771,6 +847,16 @@ int db_load_daily_reading_z_offsets(int *offsets, int count) {
     return loaded;
 }
 
+int db_queue_size() {
+    if (!db_enabled) {
+        return 0;
+    }
+    mtx_lock(&mtx);
+    int result = ring_size(&ring);
+    mtx_unlock(&mtx);
+    return result;
+}
+
 void db_worker_start(char *path) {
     if (!db_enabled) {
         return;
@@ -798,6 +884,7 @@ void db_worker_stop() {
 }
 
 int db_worker_run(void *arg) {
+    trace_thread("db");
     int running = 1;
     while (running) {
         RingEntry e;
@@ -808,16 +895,42 @@ int db_worker_run(void *arg) {
         mtx_unlock(&mtx);
         switch (e.type) {
             case BLOCK:
+                trace_begin("insert_block");
                 _db_insert_block(e.p, e.q, e.x, e.y, e.z, e.w);
+                trace_end("insert_block");
                 break;
             case LIGHT:
+                trace_begin("insert_light");
                 _db_insert_light(e.p, e.q, e.x, e.y, e.z, e.w);
+                trace_end("insert_light");
+                break;
+            case BLOCKS:
+                trace_begin("insert_blocks");
+                for (int i = 0; i < e.count; i++) {
+                    int *b = e.data + i * 4;
+                    _db_insert_block(e.p, e.q, b[0], b[1], b[2], b[3]);
+                }
+                free(e.data);
+                trace_end("insert_blocks");
+                break;
+            case LIGHTS:
+                trace_begin("insert_lights");
+                for (int i = 0; i < e.count; i++) {
+                    int *b = e.data + i * 4;
+                    _db_insert_light(e.p, e.q, b[0], b[1], b[2], b[3]);
+                }
+                free(e.data);
+                trace_end("insert_lights");
                 break;
             case KEY:
+                trace_begin("set_key");
                 _db_set_key(e.p, e.q, e.key);
+                trace_end("set_key");
                 break;
             case COMMIT:
+                trace_begin("commit");
                 _db_commit();
+                trace_end("commit");
                 break;
             case EXIT:
                 running = 0;
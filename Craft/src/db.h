@@ -24,12 +24,14 @@ void db_save_state(float x, float y, float z, float rx, float ry);
 int db_load_state(float *x, float *y, float *z, float *rx, float *ry);
 void db_insert_block(int p, int q, int x, int y, int z, int w);
 void db_insert_light(int p, int q, int x, int y, int z, int w);
+void db_insert_blocks(int p, int q, int *data, int count);
+void db_insert_lights(int p, int q, int *data, int count);
 void db_insert_sign(
     int p, int q, int x, int y, int z, int face, const char *text);
 void db_delete_sign(int x, int y, int z, int face);
 void db_delete_signs(int x, int y, int z);
 void db_delete_all_signs();
-void db_load_blocks(Map *map, int p, int q);
+int db_load_blocks(Map *map, int p, int q);
 void db_load_lights(Map *map, int p, int q);
 void db_load_signs(SignList *list, int p, int q);
 int db_get_key(int p, int q);
@@ -38,12 +40,15 @@ int db_get_metadata(const char *key, char *value, int value_length);
 void db_set_metadata(const char *key, const char *value);
 void db_insert_bible_position(const char *book, int chapter, int verse, int x, int y, int z);
 int db_get_bible_position(const char *book, int chapter, int verse, int *x, int *y, int *z);
+int db_load_bible_positions(
+    void (*func)(const char *book, int chapter, int verse, int x, int y, int z));
 void db_insert_daily_reading_block(int x, int y, int z, const char *date);
 void db_delete_daily_reading_blocks(const char *date);
 int db_get_all_daily_reading_blocks(int **out_x, int **out_y, int **out_z);
 void db_delete_all_daily_reading_blocks();
 void db_save_daily_reading_z_offsets(int *offsets, int count);
 int db_load_daily_reading_z_offsets(int *offsets, int count);
+int db_queue_size();
 void db_worker_start();
 void db_worker_stop();
 int db_worker_run(void *arg);
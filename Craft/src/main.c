@@ -7,7 +7,10 @@
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <limits.h>
+#include "arena.h"
 #include "auth.h"
+#include "chunk.h"
 #include "client.h"
 #include "config.h"
 #include "cube.h"
@@ -16,7 +19,13 @@
 #include "map.h"
 #include "matrix.h"
 #include "noise.h"
+#include "packet.h"
+#include "profile.h"
+#include "replay.h"
 #include "sign.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "trace.h"
 #include "tinycthread.h"
 #include "util.h"
 #include "voxel_text.h"
@@ -25,13 +34,30 @@
 #include "world.h"
 
 #define MAX_CHUNKS 8192
+#define DRAW_INDEX_BITS 13
+#define DRAW_INDEX_MASK ((1 << DRAW_INDEX_BITS) - 1)
 #define MAX_PLAYERS 128
 #define WORKERS 4
+#define MAX_ARENAS 64
+#define MAX_SNAPSHOTS 64
+#define MAX_REQUESTS 1024
+#define CHUNK_HASH_SIZE 16384
+#define PLAYER_HASH_SIZE 256
+#define MAX_VISIBLE_RADIUS 32
+#define VISIBLE_SIZE (MAX_VISIBLE_RADIUS * 2 + 1)
+#define STREAM_SIZE (1 << 20)
+#define ARENA_VERTICES 524288
 #define MAX_TEXT_LENGTH 256
+#define MAX_SEARCH_RESULTS 8
 #define MAX_NAME_LENGTH 32
 #define MAX_PATH_LENGTH 256
 #define MAX_ADDR_LENGTH 256
 
+// sort keys keep the chunk index in the low DRAW_INDEX_BITS bits
+#if MAX_CHUNKS > (1 << DRAW_INDEX_BITS)
+#error "MAX_CHUNKS does not fit in DRAW_INDEX_BITS"
+#endif
+
 #define ALIGN_LEFT 0
 #define ALIGN_CENTER 1
 #define ALIGN_RIGHT 2
@@ -43,6 +69,14 @@
 #define WORKER_BUSY 1
 #define WORKER_DONE 2
 
+typedef struct {
+    int miny;
+    int maxy;
+    int faces;
+    int transparent_faces;
+    GLfloat *data;
+} Mesh;
+
 typedef struct {
     Map map;
     Map lights;
@@ -50,33 +84,35 @@ typedef struct {
     int p;
     int q;
     int faces;
+    int transparent_faces;
     int sign_faces;
     int dirty;
+    int loaded;
+    int generation;
     int miny;
     int maxy;
-    GLuint buffer;
+    int meshed;
+    int arena;
+    int offset;
+    int capacity;
     GLuint sign_buffer;
+    GLuint query;
+    int query_pending;
+    int occluded;
+    int seen;
+    int pending;
+    Mesh mesh;
 } Chunk;
 
-typedef struct {
-    int p;
-    int q;
-    int load;
-    Map *block_maps[3][3];
-    Map *light_maps[3][3];
-    int miny;
-    int maxy;
-    int faces;
-    GLfloat *data;
-} WorkerItem;
-
 typedef struct {
     int index;
     int state;
+    int exit;
     thrd_t thrd;
     mtx_t mtx;
     cnd_t cnd;
     WorkerItem item;
+    Snapshot *snapshot;
 } Worker;
 
 typedef struct {
@@ -86,6 +122,12 @@ typedef struct {
     int w;
 } Block;
 
+typedef struct {
+    int p;
+    int q;
+    int score;
+} ChunkRequest;
+
 typedef struct {
     float x;
     float y;
@@ -101,9 +143,36 @@ typedef struct {
     State state;
     State state1;
     State state2;
-    GLuint buffer;
 } Player;
 
+typedef struct {
+    int active;
+    State state;
+    double start;
+} Teleport;
+
+typedef struct {
+    int p;
+    int q;
+    int radius;
+    int plane_count;
+    float matrix[16];
+    float planes[6][4];
+    float nx[6];
+    float ny[6];
+    float nz[6];
+    float nw[6];
+    unsigned char cells[VISIBLE_SIZE * VISIBLE_SIZE];
+    int count;
+    short cell_p[VISIBLE_SIZE * VISIBLE_SIZE];
+    short cell_q[VISIBLE_SIZE * VISIBLE_SIZE];
+    int frame;
+    int query_count;
+    int queries[VISIBLE_SIZE * VISIBLE_SIZE];
+    int draw_count;
+    int draws[VISIBLE_SIZE * VISIBLE_SIZE];
+} Visibility;
+
 typedef struct {
     GLuint program;
     GLuint position;
@@ -117,19 +186,39 @@ typedef struct {
     GLuint extra2;
     GLuint extra3;
     GLuint extra4;
+    GLuint model;
 } Attrib;
 
 typedef struct {
     GLFWwindow *window;
     Worker workers[WORKERS];
+    Snapshot *snapshots[MAX_SNAPSHOTS];
+    int snapshot_count;
+    ChunkRequest requests[MAX_REQUESTS];
+    int request_count;
     Chunk chunks[MAX_CHUNKS];
     int chunk_count;
+    int chunk_hash[CHUNK_HASH_SIZE];
+    Visibility visibility;
+    Visibility inset_visibility;
+    Visibility *view;
+    Arena arenas[MAX_ARENAS];
+    int arena_count;
+    Stream stream;
+    GLuint player_buffer;
+    GLfloat *text_data;
+    int text_length;
+    int text_capacity;
+    int ready_count;
+    int ready_p[MAX_CHUNKS];
+    int ready_q[MAX_CHUNKS];
     int create_radius;
     int render_radius;
     int delete_radius;
     int sign_radius;
     Player players[MAX_PLAYERS];
     int player_count;
+    int player_hash[PLAYER_HASH_SIZE];
     int typing;
     char typing_buffer[MAX_TEXT_LENGTH];
     int typing_cursor;  // Cursor position in typing_buffer
@@ -156,6 +245,13 @@ typedef struct {
     Block block1;
     Block copy0;
     Block copy1;
+    Teleport teleport;
+    int show_stats;
+    int chunk_generation;
+    float velocity_x;
+    float velocity_z;
+    float last_x;
+    float last_z;
 } Model;
 
 static Model model;
@@ -165,12 +261,16 @@ int chunked(float x) {
     return floorf(roundf(x) / CHUNK_SIZE);
 }
 
+int compare_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
 float time_of_day() {
     if (g->day_length <= 0) {
         return 0.5;
     }
     float t;
-    t = glfwGetTime();
+    t = replay_time();
     t = t / g->day_length;
     t = t - (int)t;
     return t;
@@ -227,79 +327,36 @@ void get_motion_vector(int flying, int sz, int sx, float rx, float ry,
     }
 }
 
-GLuint gen_crosshair_buffer() {
-    int x = g->width / 2;
-    int y = g->height / 2;
-    int p = 10 * g->scale;
-    float data[] = {
-        x, y - p, x, y + p,
-        x - p, y, x + p, y
-    };
-    return gen_buffer(sizeof(data), data);
-}
-
-GLuint gen_wireframe_buffer(float x, float y, float z, float n) {
-    float data[72];
-    make_cube_wireframe(data, x, y, z, n);
-    return gen_buffer(sizeof(data), data);
-}
-
 GLuint gen_sky_buffer() {
     float data[12288];
     make_sphere(data, 1, 3);
     return gen_buffer(sizeof(data), data);
 }
 
-GLuint gen_cube_buffer(float x, float y, float z, float n, int w) {
-    GLfloat *data = malloc_faces(10, 6);
-    float ao[6][4] = {0};
-    float light[6][4] = {
-        {0.5, 0.5, 0.5, 0.5},
-        {0.5, 0.5, 0.5, 0.5},
-        {0.5, 0.5, 0.5, 0.5},
-        {0.5, 0.5, 0.5, 0.5},
-        {0.5, 0.5, 0.5, 0.5},
-        {0.5, 0.5, 0.5, 0.5}
-    };
-    make_cube(data, ao, light, 1, 1, 1, 1, 1, 1, x, y, z, n, w);
-    return gen_faces(10, 6, data);
-}
-
-GLuint gen_plant_buffer(float x, float y, float z, float n, int w) {
-    GLfloat *data = malloc_faces(10, 4);
-    float ao = 0;
-    float light = 1;
-    make_plant(data, ao, light, x, y, z, n, w, 45);
-    return gen_faces(10, 4, data);
-}
-
-GLuint gen_player_buffer(float x, float y, float z, float rx, float ry) {
+GLuint gen_player_buffer() {
     GLfloat *data = malloc_faces(10, 6);
-    make_player(data, x, y, z, rx, ry);
+    make_player(data, 0, 0, 0, 0, 0);
     return gen_faces(10, 6, data);
 }
 
-GLuint gen_text_buffer(float x, float y, float n, char *text) {
-    int length = strlen(text);
-    GLfloat *data = malloc_faces(4, length);
-    for (int i = 0; i < length; i++) {
-        make_character(data + i * 24, x, y, n / 2, n, text[i]);
-        x += n;
-    }
-    return gen_faces(4, length, data);
+int stream_faces(int components, int faces, GLfloat *data) {
+    return stream_write(
+        &g->stream, sizeof(GLfloat) * 6 * components * faces, data);
 }
 
-void draw_triangles_3d_ao(Attrib *attrib, GLuint buffer, int count) {
+void draw_triangles_3d_ao(
+    Attrib *attrib, GLuint buffer, int offset, int count)
+{
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
     glEnableVertexAttribArray(attrib->position);
     glEnableVertexAttribArray(attrib->normal);
     glEnableVertexAttribArray(attrib->uv);
     glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
-        sizeof(GLfloat) * 10, 0);
+        sizeof(GLfloat) * 10, (GLvoid *)(size_t)offset);
     glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
-        sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
+        sizeof(GLfloat) * 10, (GLvoid *)(offset + sizeof(GLfloat) * 3));
     glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
-        sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
+        sizeof(GLfloat) * 10, (GLvoid *)(offset + sizeof(GLfloat) * 6));
     glDrawArrays(GL_TRIANGLES, 0, count);
     glDisableVertexAttribArray(attrib->position);
     glDisableVertexAttribArray(attrib->normal);
@@ -307,14 +364,16 @@ void draw_triangles_3d_ao(Attrib *attrib, GLuint buffer, int count) {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void draw_triangles_3d_text(Attrib *attrib, GLuint buffer, int count) {
+void draw_triangles_3d_text(
+    Attrib *attrib, GLuint buffer, int offset, int count)
+{
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
     glEnableVertexAttribArray(attrib->position);
     glEnableVertexAttribArray(attrib->uv);
     glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
-        sizeof(GLfloat) * 5, 0);
+        sizeof(GLfloat) * 5, (GLvoid *)(size_t)offset);
     glVertexAttribPointer(attrib->uv, 2, GL_FLOAT, GL_FALSE,
-        sizeof(GLfloat) * 5, (GLvoid *)(sizeof(GLfloat) * 3));
+        sizeof(GLfloat) * 5, (GLvoid *)(offset + sizeof(GLfloat) * 3));
     glDrawArrays(GL_TRIANGLES, 0, count);
     glDisableVertexAttribArray(attrib->position);
     glDisableVertexAttribArray(attrib->uv);
@@ -339,79 +398,193 @@ void draw_triangles_3d(Attrib *attrib, GLuint buffer, int count) {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void draw_triangles_2d(Attrib *attrib, GLuint buffer, int count) {
+void draw_triangles_2d(
+    Attrib *attrib, GLuint buffer, int offset, int count)
+{
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
     glEnableVertexAttribArray(attrib->position);
     glEnableVertexAttribArray(attrib->uv);
     glVertexAttribPointer(attrib->position, 2, GL_FLOAT, GL_FALSE,
-        sizeof(GLfloat) * 4, 0);
+        sizeof(GLfloat) * 4, (GLvoid *)(size_t)offset);
     glVertexAttribPointer(attrib->uv, 2, GL_FLOAT, GL_FALSE,
-        sizeof(GLfloat) * 4, (GLvoid *)(sizeof(GLfloat) * 2));
+        sizeof(GLfloat) * 4, (GLvoid *)(offset + sizeof(GLfloat) * 2));
     glDrawArrays(GL_TRIANGLES, 0, count);
     glDisableVertexAttribArray(attrib->position);
     glDisableVertexAttribArray(attrib->uv);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void draw_lines(Attrib *attrib, GLuint buffer, int components, int count) {
+void draw_lines(
+    Attrib *attrib, GLuint buffer, int offset, int components, int count)
+{
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
     glEnableVertexAttribArray(attrib->position);
     glVertexAttribPointer(
-        attrib->position, components, GL_FLOAT, GL_FALSE, 0, 0);
+        attrib->position, components, GL_FLOAT, GL_FALSE, 0,
+        (GLvoid *)(size_t)offset);
     glDrawArrays(GL_LINES, 0, count);
     glDisableVertexAttribArray(attrib->position);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void draw_chunk(Attrib *attrib, Chunk *chunk) {
-    draw_triangles_3d_ao(attrib, chunk->buffer, chunk->faces * 6);
+void bind_arena(Attrib *attrib, Arena *arena) {
+    glBindBuffer(GL_ARRAY_BUFFER, arena->buffer);
+    glEnableVertexAttribArray(attrib->position);
+    glEnableVertexAttribArray(attrib->normal);
+    glEnableVertexAttribArray(attrib->uv);
+    glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
+        sizeof(GLfloat) * 10, 0);
+    glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
+        sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
+    glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
+        sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
+}
+
+void unbind_arena(Attrib *attrib) {
+    glDisableVertexAttribArray(attrib->position);
+    glDisableVertexAttribArray(attrib->normal);
+    glDisableVertexAttribArray(attrib->uv);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void draw_arenas(Attrib *attrib) {
+    int vao = GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object;
+    for (int i = 0; i < g->arena_count; i++) {
+        Arena *arena = g->arenas + i;
+        if (!arena->batch_count) {
+            continue;
+        }
+        if (vao) {
+            if (!arena->vao) {
+                glGenVertexArrays(1, &arena->vao);
+                glBindVertexArray(arena->vao);
+                bind_arena(attrib, arena);
+            }
+            else {
+                glBindVertexArray(arena->vao);
+            }
+        }
+        else {
+            bind_arena(attrib, arena);
+        }
+        glMultiDrawArrays(GL_TRIANGLES,
+            arena->batch_first, arena->batch_size, arena->batch_count);
+        if (vao) {
+            glBindVertexArray(0);
+        }
+        else {
+            unbind_arena(attrib);
+        }
+        arena->batch_count = 0;
+    }
 }
 
-void draw_item(Attrib *attrib, GLuint buffer, int count) {
-    draw_triangles_3d_ao(attrib, buffer, count);
+void draw_item(Attrib *attrib, GLuint buffer, int offset, int count) {
+    draw_triangles_3d_ao(attrib, buffer, offset, count);
 }
 
-void draw_text(Attrib *attrib, GLuint buffer, int length) {
+void draw_text(Attrib *attrib, GLuint buffer, int offset, int length) {
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    draw_triangles_2d(attrib, buffer, length * 6);
+    draw_triangles_2d(attrib, buffer, offset, length * 6);
     glDisable(GL_BLEND);
 }
 
 void draw_signs(Attrib *attrib, Chunk *chunk) {
     glEnable(GL_POLYGON_OFFSET_FILL);
     glPolygonOffset(-8, -1024);
-    draw_triangles_3d_text(attrib, chunk->sign_buffer, chunk->sign_faces * 6);
+    draw_triangles_3d_text(
+        attrib, chunk->sign_buffer, 0, chunk->sign_faces * 6);
     glDisable(GL_POLYGON_OFFSET_FILL);
 }
 
-void draw_sign(Attrib *attrib, GLuint buffer, int length) {
+void draw_sign(Attrib *attrib, GLuint buffer, int offset, int length) {
     glEnable(GL_POLYGON_OFFSET_FILL);
     glPolygonOffset(-8, -1024);
-    draw_triangles_3d_text(attrib, buffer, length * 6);
+    draw_triangles_3d_text(attrib, buffer, offset, length * 6);
     glDisable(GL_POLYGON_OFFSET_FILL);
 }
 
-void draw_cube(Attrib *attrib, GLuint buffer) {
-    draw_item(attrib, buffer, 36);
+void draw_cube(Attrib *attrib, GLuint buffer, int offset) {
+    draw_item(attrib, buffer, offset, 36);
 }
 
-void draw_plant(Attrib *attrib, GLuint buffer) {
-    draw_item(attrib, buffer, 24);
+void draw_plant(Attrib *attrib, GLuint buffer, int offset) {
+    draw_item(attrib, buffer, offset, 24);
 }
 
+// every player shares one cube mesh placed by the model matrix
 void draw_player(Attrib *attrib, Player *player) {
-    draw_cube(attrib, player->buffer);
+    State *s = &player->state;
+    float model[16];
+    float a[16];
+    mat_rotate(model, 0, 1, 0, s->rx);
+    mat_rotate(a, cosf(s->rx), 0, sinf(s->rx), -s->ry);
+    mat_multiply(model, a, model);
+    mat_translate(a, s->x, s->y, s->z);
+    mat_multiply(model, a, model);
+    glUniformMatrix4fv(attrib->model, 1, GL_FALSE, model);
+    draw_cube(attrib, g->player_buffer, 0);
 }
 
-Player *find_player(int id) {
-    for (int i = 0; i < g->player_count; i++) {
-        Player *player = g->players + i;
+// player_hash holds player index + 1, or 0 for an empty slot
+int player_hash_slot(int id) {
+    unsigned int h = (unsigned int)id * 2654435761u;
+    return (h ^ (h >> 16)) & (PLAYER_HASH_SIZE - 1);
+}
+
+void player_hash_insert(Player *player) {
+    int i = player_hash_slot(player->id);
+    while (g->player_hash[i]) {
+        i = (i + 1) & (PLAYER_HASH_SIZE - 1);
+    }
+    g->player_hash[i] = player - g->players + 1;
+}
+
+int player_hash_find(int id) {
+    int i = player_hash_slot(id);
+    while (g->player_hash[i]) {
+        Player *player = g->players + g->player_hash[i] - 1;
         if (player->id == id) {
-            return player;
+            return i;
         }
+        i = (i + 1) & (PLAYER_HASH_SIZE - 1);
     }
-    return 0;
+    return -1;
+}
+
+void player_hash_remove(int id) {
+    int i = player_hash_find(id);
+    if (i < 0) {
+        return;
+    }
+    // backward shift, as in chunk_hash_remove
+    int j = i;
+    g->player_hash[i] = 0;
+    while (1) {
+        j = (j + 1) & (PLAYER_HASH_SIZE - 1);
+        if (!g->player_hash[j]) {
+            break;
+        }
+        Player *player = g->players + g->player_hash[j] - 1;
+        int k = player_hash_slot(player->id);
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            g->player_hash[i] = g->player_hash[j];
+            g->player_hash[j] = 0;
+            i = j;
+        }
+    }
+}
+
+Player *find_player(int id) {
+    int i = player_hash_find(id);
+    return i < 0 ? 0 : g->players + g->player_hash[i] - 1;
+}
+
+void set_player_id(Player *player, int id) {
+    player_hash_remove(player->id);
+    player->id = id;
+    player_hash_insert(player);
 }
 
 void update_player(Player *player,
@@ -422,7 +595,7 @@ void update_player(Player *player,
         State *s2 = &player->state2;
         memcpy(s1, s2, sizeof(State));
         s2->x = x; s2->y = y; s2->z = z; s2->rx = rx; s2->ry = ry;
-        s2->t = glfwGetTime();
+        s2->t = replay_time();
         if (s2->rx - s1->rx > PI) {
             s1->rx += 2 * PI;
         }
@@ -433,8 +606,6 @@ void update_player(Player *player,
     else {
         State *s = &player->state;
         s->x = x; s->y = y; s->z = z; s->rx = rx; s->ry = ry;
-        del_buffer(player->buffer);
-        player->buffer = gen_player_buffer(s->x, s->y, s->z, s->rx, s->ry);
     }
 }
 
@@ -442,7 +613,7 @@ void interpolate_player(Player *player) {
     State *s1 = &player->state1;
     State *s2 = &player->state2;
     float t1 = s2->t - s1->t;
-    float t2 = glfwGetTime() - s2->t;
+    float t2 = replay_time() - s2->t;
     t1 = MIN(t1, 1);
     t1 = MAX(t1, 0.1);
     float p = MIN(t2 / t1, 1);
@@ -461,19 +632,20 @@ void delete_player(int id) {
     if (!player) {
         return;
     }
+    player_hash_remove(id);
     int count = g->player_count;
-    del_buffer(player->buffer);
     Player *other = g->players + (--count);
-    memcpy(player, other, sizeof(Player));
+    if (other != player) {
+        int i = player_hash_find(other->id);
+        g->player_hash[i] = player - g->players + 1;
+        memcpy(player, other, sizeof(Player));
+    }
     g->player_count = count;
 }
 
 void delete_all_players() {
-    for (int i = 0; i < g->player_count; i++) {
-        Player *player = g->players + i;
-        del_buffer(player->buffer);
-    }
     g->player_count = 0;
+    memset(g->player_hash, 0, sizeof(g->player_hash));
 }
 
 float player_player_distance(Player *p1, Player *p2) {
@@ -521,14 +693,58 @@ Player *player_crosshair(Player *player) {
     return result;
 }
 
-Chunk *find_chunk(int p, int q) {
-    for (int i = 0; i < g->chunk_count; i++) {
-        Chunk *chunk = g->chunks + i;
+// chunk_hash holds chunk index + 1, or 0 for an empty slot
+int chunk_hash_slot(int p, int q) {
+    unsigned int h = (unsigned int)p * 73856093u ^ (unsigned int)q * 19349663u;
+    return (h ^ (h >> 15)) & (CHUNK_HASH_SIZE - 1);
+}
+
+void chunk_hash_insert(Chunk *chunk) {
+    int i = chunk_hash_slot(chunk->p, chunk->q);
+    while (g->chunk_hash[i]) {
+        i = (i + 1) & (CHUNK_HASH_SIZE - 1);
+    }
+    g->chunk_hash[i] = chunk - g->chunks + 1;
+}
+
+int chunk_hash_find(int p, int q) {
+    int i = chunk_hash_slot(p, q);
+    while (g->chunk_hash[i]) {
+        Chunk *chunk = g->chunks + g->chunk_hash[i] - 1;
         if (chunk->p == p && chunk->q == q) {
-            return chunk;
+            return i;
         }
+        i = (i + 1) & (CHUNK_HASH_SIZE - 1);
     }
-    return 0;
+    return -1;
+}
+
+void chunk_hash_remove(int p, int q) {
+    int i = chunk_hash_find(p, q);
+    if (i < 0) {
+        return;
+    }
+    // backward shift so probe sequences stay unbroken without tombstones
+    int j = i;
+    g->chunk_hash[i] = 0;
+    while (1) {
+        j = (j + 1) & (CHUNK_HASH_SIZE - 1);
+        if (!g->chunk_hash[j]) {
+            break;
+        }
+        Chunk *chunk = g->chunks + g->chunk_hash[j] - 1;
+        int k = chunk_hash_slot(chunk->p, chunk->q);
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            g->chunk_hash[i] = g->chunk_hash[j];
+            g->chunk_hash[j] = 0;
+            i = j;
+        }
+    }
+}
+
+Chunk *find_chunk(int p, int q) {
+    int i = chunk_hash_find(p, q);
+    return i < 0 ? 0 : g->chunks + g->chunk_hash[i] - 1;
 }
 
 int chunk_distance(Chunk *chunk, int p, int q) {
@@ -537,47 +753,142 @@ int chunk_distance(Chunk *chunk, int p, int q) {
     return MAX(dp, dq);
 }
 
-int chunk_visible(float planes[6][4], int p, int q, int miny, int maxy) {
-    int x = p * CHUNK_SIZE - 1;
-    int z = q * CHUNK_SIZE - 1;
-    int d = CHUNK_SIZE + 1;
-    float points[8][3] = {
-        {x + 0, miny, z + 0},
-        {x + d, miny, z + 0},
-        {x + 0, miny, z + d},
-        {x + d, miny, z + d},
-        {x + 0, maxy, z + 0},
-        {x + d, maxy, z + 0},
-        {x + 0, maxy, z + d},
-        {x + d, maxy, z + d}
-    };
-    int n = g->ortho ? 4 : 6;
-    for (int i = 0; i < n; i++) {
-        int in = 0;
-        int out = 0;
-        for (int j = 0; j < 8; j++) {
-            float d =
-                planes[i][0] * points[j][0] +
-                planes[i][1] * points[j][1] +
-                planes[i][2] * points[j][2] +
-                planes[i][3];
-            if (d < 0) {
-                out++;
-            }
-            else {
-                in++;
-            }
-            if (in && out) {
-                break;
-            }
+// Tests an axis aligned box against the frustum using the corner furthest
+// along each plane normal. Planes the box lies entirely inside of are
+// cleared from *mask so nested boxes can skip them.
+int box_visible(
+    Visibility *v, float x0, float y0, float z0,
+    float x1, float y1, float z1, int *mask)
+{
+    for (int i = 0; i < v->plane_count; i++) {
+        if (!(*mask & (1 << i))) {
+            continue;
         }
-        if (in == 0) {
+        float nx = v->nx[i];
+        float ny = v->ny[i];
+        float nz = v->nz[i];
+        float far =
+            nx * (nx >= 0 ? x1 : x0) +
+            ny * (ny >= 0 ? y1 : y0) +
+            nz * (nz >= 0 ? z1 : z0) + v->nw[i];
+        if (far < 0) {
             return 0;
         }
+        float near =
+            nx * (nx >= 0 ? x0 : x1) +
+            ny * (ny >= 0 ? y0 : y1) +
+            nz * (nz >= 0 ? z0 : z1) + v->nw[i];
+        if (near >= 0) {
+            *mask &= ~(1 << i);
+        }
     }
     return 1;
 }
 
+void mark_visible(Visibility *v, int a, int b, int value) {
+    int dp = a - v->p + MAX_VISIBLE_RADIUS;
+    int dq = b - v->q + MAX_VISIBLE_RADIUS;
+    v->cells[dp * VISIBLE_SIZE + dq] = value;
+    v->cell_p[v->count] = a;
+    v->cell_q[v->count] = b;
+    v->count++;
+}
+
+// Quadtree walk over the chunk columns in [a0, a1] x [b0, b1]. Subtrees
+// outside the frustum are dropped whole and subtrees fully inside it are
+// accepted without further plane tests.
+void cull_columns(Visibility *v, int a0, int b0, int a1, int b1, int mask) {
+    float x0 = a0 * CHUNK_SIZE - 1;
+    float z0 = b0 * CHUNK_SIZE - 1;
+    float x1 = (a1 + 1) * CHUNK_SIZE;
+    float z1 = (b1 + 1) * CHUNK_SIZE;
+    if (mask && !box_visible(v, x0, 0, z0, x1, 256, z1, &mask)) {
+        return;
+    }
+    if (!mask || (a0 == a1 && b0 == b1)) {
+        for (int a = a0; a <= a1; a++) {
+            for (int b = b0; b <= b1; b++) {
+                mark_visible(v, a, b, mask ? 1 : 2);
+            }
+        }
+        return;
+    }
+    int am = a0 + (a1 - a0) / 2;
+    int bm = b0 + (b1 - b0) / 2;
+    cull_columns(v, a0, b0, am, bm, mask);
+    if (am < a1) {
+        cull_columns(v, am + 1, b0, a1, bm, mask);
+    }
+    if (bm < b1) {
+        cull_columns(v, a0, bm + 1, am, b1, mask);
+    }
+    if (am < a1 && bm < b1) {
+        cull_columns(v, am + 1, bm + 1, a1, b1, mask);
+    }
+}
+
+// One camera and culling pass per view. The main view's is shared by chunk
+// rendering, sign rendering and job scheduling; the picture-in-picture
+// view only draws with its own.
+void update_visibility(Visibility *v, Player *player) {
+    State *s = &player->state;
+    set_matrix_3d(
+        v->matrix, g->width, g->height,
+        s->x, s->y, s->z, s->rx, s->ry, g->fov, g->ortho, g->render_radius);
+    frustum_planes(v->planes, g->render_radius, v->matrix);
+    v->plane_count = g->ortho ? 4 : 6;
+    for (int i = 0; i < 6; i++) {
+        v->nx[i] = v->planes[i][0];
+        v->ny[i] = v->planes[i][1];
+        v->nz[i] = v->planes[i][2];
+        v->nw[i] = v->planes[i][3];
+    }
+    v->p = chunked(s->x);
+    v->q = chunked(s->z);
+    v->radius = MIN(
+        MAX(g->render_radius, g->create_radius), MAX_VISIBLE_RADIUS);
+    v->count = 0;
+    memset(v->cells, 0, sizeof(v->cells));
+    int r = v->radius;
+    cull_columns(
+        v, v->p - r, v->q - r, v->p + r, v->q + r,
+        (1 << v->plane_count) - 1);
+}
+
+// 0 = culled, 1 = column intersects the frustum, 2 = column fully inside
+int column_visibility(Visibility *v, int a, int b) {
+    int dp = a - v->p;
+    int dq = b - v->q;
+    if (ABS(dp) > v->radius || ABS(dq) > v->radius) {
+        return 0;
+    }
+    dp += MAX_VISIBLE_RADIUS;
+    dq += MAX_VISIBLE_RADIUS;
+    return v->cells[dp * VISIBLE_SIZE + dq];
+}
+
+// Lower scores are loaded and requested first: columns in view, then the
+// nearest. Chunks ahead on the flight path count as in view, so the path
+// still fills in from the player outwards.
+int chunk_score(int a, int b, int distance, int ahead) {
+    int invisible = !ahead && !column_visibility(&g->visibility, a, b);
+    return (invisible << 24) | distance;
+}
+
+int chunk_visible(Chunk *chunk) {
+    Visibility *v = g->view;
+    int visibility = column_visibility(v, chunk->p, chunk->q);
+    if (visibility != 1) {
+        return visibility;
+    }
+    int mask = (1 << v->plane_count) - 1;
+    int x = chunk->p * CHUNK_SIZE - 1;
+    int z = chunk->q * CHUNK_SIZE - 1;
+    int d = CHUNK_SIZE + 1;
+    return box_visible(
+        v, x, chunk->miny, z, x + d, chunk->maxy, z + d, &mask);
+}
+
 int highest_block(float x, float z) {
     int result = -1;
     int nx = roundf(x);
@@ -812,7 +1123,7 @@ int _gen_sign_buffer(
     return count;
 }
 
-void gen_sign_buffer(Chunk *chunk) {
+int gen_sign_buffer(Chunk *chunk) {
     SignList *signs = &chunk->signs;
 
     // first pass - count characters
@@ -831,9 +1142,17 @@ void gen_sign_buffer(Chunk *chunk) {
             data + faces * 30, e->x, e->y, e->z, e->face, e->text);
     }
 
-    del_buffer(chunk->sign_buffer);
-    chunk->sign_buffer = gen_faces(5, faces, data);
+    // respecify the existing buffer instead of deleting and recreating it
+    int size = sizeof(GLfloat) * 30 * faces;
+    if (!chunk->sign_buffer) {
+        glGenBuffers(1, &chunk->sign_buffer);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, chunk->sign_buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    free(data);
     chunk->sign_faces = faces;
+    return size;
 }
 
 int has_lights(Chunk *chunk) {
@@ -872,284 +1191,217 @@ void dirty_chunk(Chunk *chunk) {
     }
 }
 
-void occlusion(
-    char neighbors[27], char lights[27], float shades[27],
-    float ao[6][4], float light[6][4])
-{
-    static const int lookup3[6][4][3] = {
-        {{0, 1, 3}, {2, 1, 5}, {6, 3, 7}, {8, 5, 7}},
-        {{18, 19, 21}, {20, 19, 23}, {24, 21, 25}, {26, 23, 25}},
-        {{6, 7, 15}, {8, 7, 17}, {24, 15, 25}, {26, 17, 25}},
-        {{0, 1, 9}, {2, 1, 11}, {18, 9, 19}, {20, 11, 19}},
-        {{0, 3, 9}, {6, 3, 15}, {18, 9, 21}, {24, 15, 21}},
-        {{2, 5, 11}, {8, 5, 17}, {20, 11, 23}, {26, 17, 23}}
-    };
-   static const int lookup4[6][4][4] = {
-        {{0, 1, 3, 4}, {1, 2, 4, 5}, {3, 4, 6, 7}, {4, 5, 7, 8}},
-        {{18, 19, 21, 22}, {19, 20, 22, 23}, {21, 22, 24, 25}, {22, 23, 25, 26}},
-        {{6, 7, 15, 16}, {7, 8, 16, 17}, {15, 16, 24, 25}, {16, 17, 25, 26}},
-        {{0, 1, 9, 10}, {1, 2, 10, 11}, {9, 10, 18, 19}, {10, 11, 19, 20}},
-        {{0, 3, 9, 12}, {3, 6, 12, 15}, {9, 12, 18, 21}, {12, 15, 21, 24}},
-        {{2, 5, 11, 14}, {5, 8, 14, 17}, {11, 14, 20, 23}, {14, 17, 23, 26}}
-    };
-    static const float curve[4] = {0.0, 0.25, 0.5, 0.75};
-    for (int i = 0; i < 6; i++) {
-        for (int j = 0; j < 4; j++) {
-            int corner = neighbors[lookup3[i][j][0]];
-            int side1 = neighbors[lookup3[i][j][1]];
-            int side2 = neighbors[lookup3[i][j][2]];
-            int value = side1 && side2 ? 3 : corner + side1 + side2;
-            float shade_sum = 0;
-            float light_sum = 0;
-            int is_light = lights[13] == 15;
-            for (int k = 0; k < 4; k++) {
-                shade_sum += shades[lookup4[i][j][k]];
-                light_sum += lights[lookup4[i][j][k]];
-            }
-            if (is_light) {
-                light_sum = 15 * 4 * 10;
-            }
-            float total = curve[value] + shade_sum / 4.0;
-            ao[i][j] = MIN(total, 1.0);
-            light[i][j] = light_sum / 15.0 / 4.0;
-        }
-    }
-}
-
-#define XZ_SIZE (CHUNK_SIZE * 3 + 2)
-#define XZ_LO (CHUNK_SIZE)
-#define XZ_HI (CHUNK_SIZE * 2 + 1)
-#define Y_SIZE 258
-#define XYZ(x, y, z) ((y) * XZ_SIZE * XZ_SIZE + (x) * XZ_SIZE + (z))
-#define XZ(x, z) ((x) * XZ_SIZE + (z))
-
-void light_fill(
-    char *opaque, char *light,
-    int x, int y, int z, int w, int force)
-{
-    if (x + w < XZ_LO || z + w < XZ_LO) {
-        return;
-    }
-    if (x - w > XZ_HI || z - w > XZ_HI) {
-        return;
-    }
-    if (y < 0 || y >= Y_SIZE) {
-        return;
-    }
-    if (light[XYZ(x, y, z)] >= w) {
-        return;
-    }
-    if (!force && opaque[XYZ(x, y, z)]) {
-        return;
-    }
-    light[XYZ(x, y, z)] = w--;
-    light_fill(opaque, light, x - 1, y, z, w, 0);
-    light_fill(opaque, light, x + 1, y, z, w, 0);
-    light_fill(opaque, light, x, y - 1, z, w, 0);
-    light_fill(opaque, light, x, y + 1, z, w, 0);
-    light_fill(opaque, light, x, y, z - 1, w, 0);
-    light_fill(opaque, light, x, y, z + 1, w, 0);
-}
-
-void compute_chunk(WorkerItem *item) {
-    char *opaque = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
-    char *light = (char *)calloc(XZ_SIZE * XZ_SIZE * Y_SIZE, sizeof(char));
-    char *highest = (char *)calloc(XZ_SIZE * XZ_SIZE, sizeof(char));
-
-    int ox = item->p * CHUNK_SIZE - CHUNK_SIZE - 1;
-    int oy = -1;
-    int oz = item->q * CHUNK_SIZE - CHUNK_SIZE - 1;
-
-    // check for lights
-    int has_light = 0;
-    if (SHOW_LIGHTS) {
-        for (int a = 0; a < 3; a++) {
-            for (int b = 0; b < 3; b++) {
-                Map *map = item->light_maps[a][b];
-                if (map && map->size) {
-                    has_light = 1;
-                }
+// Chunks are meshed with the edges of the chunks around them, so a block on
+// the edge of its chunk also redraws the neighbours that touch it.
+void dirty_neighbors(int x, int z) {
+    int p = chunked(x);
+    int q = chunked(z);
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dz = -1; dz <= 1; dz++) {
+            if (dx == 0 && dz == 0) {
+                continue;
             }
-        }
-    }
-
-    // populate opaque array
-    for (int a = 0; a < 3; a++) {
-        for (int b = 0; b < 3; b++) {
-            Map *map = item->block_maps[a][b];
-            if (!map) {
+            if (dx && chunked(x + dx) == p) {
                 continue;
             }
-            MAP_FOR_EACH(map, ex, ey, ez, ew) {
-                int x = ex - ox;
-                int y = ey - oy;
-                int z = ez - oz;
-                int w = ew;
-                // TODO: this should be unnecessary
-                if (x < 0 || y < 0 || z < 0) {
-                    continue;
-                }
-                if (x >= XZ_SIZE || y >= Y_SIZE || z >= XZ_SIZE) {
-                    continue;
-                }
-                // END TODO
-                opaque[XYZ(x, y, z)] = !is_transparent(w);
-                if (opaque[XYZ(x, y, z)]) {
-                    highest[XZ(x, z)] = MAX(highest[XZ(x, z)], y);
-                }
-            } END_MAP_FOR_EACH;
+            if (dz && chunked(z + dz) == q) {
+                continue;
+            }
+            Chunk *chunk = find_chunk(p + dx, q + dz);
+            if (chunk) {
+                dirty_chunk(chunk);
+            }
         }
     }
+}
 
-    // flood fill light intensities
-    if (has_light) {
-        for (int a = 0; a < 3; a++) {
-            for (int b = 0; b < 3; b++) {
-                Map *map = item->light_maps[a][b];
-                if (!map) {
-                    continue;
-                }
-                MAP_FOR_EACH(map, ex, ey, ez, ew) {
-                    int x = ex - ox;
-                    int y = ey - oy;
-                    int z = ez - oz;
-                    light_fill(opaque, light, x, y, z, ew, 1);
-                } END_MAP_FOR_EACH;
-            }
-        }
+int mesh_bytes() {
+    int result = 0;
+    for (int i = 0; i < g->arena_count; i++) {
+        result += g->arenas[i].used * sizeof(GLfloat) * 10;
     }
+    return result;
+}
 
-    Map *map = item->block_maps[1][1];
+void release_mesh(Chunk *chunk) {
+    if (chunk->arena >= 0) {
+        arena_release(
+            g->arenas + chunk->arena, chunk->offset, chunk->capacity);
+    }
+    chunk->arena = -1;
+    chunk->offset = 0;
+    chunk->capacity = 0;
+}
 
-    // count exposed faces
-    int miny = 256;
-    int maxy = 0;
-    int faces = 0;
-    MAP_FOR_EACH(map, ex, ey, ez, ew) {
-        if (ew <= 0) {
-            continue;
-        }
-        int x = ex - ox;
-        int y = ey - oy;
-        int z = ez - oz;
-        int f1 = !opaque[XYZ(x - 1, y, z)];
-        int f2 = !opaque[XYZ(x + 1, y, z)];
-        int f3 = !opaque[XYZ(x, y + 1, z)];
-        int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
-        int f5 = !opaque[XYZ(x, y, z - 1)];
-        int f6 = !opaque[XYZ(x, y, z + 1)];
-        int total = f1 + f2 + f3 + f4 + f5 + f6;
-        if (total == 0) {
-            continue;
-        }
-        if (is_plant(ew)) {
-            total = 4;
+int alloc_mesh(Chunk *chunk, int count) {
+    for (int i = 0; i < g->arena_count; i++) {
+        int offset = arena_malloc(g->arenas + i, count);
+        if (offset >= 0) {
+            chunk->arena = i;
+            chunk->offset = offset;
+            chunk->capacity = ARENA_ROUND(count);
+            return 1;
         }
-        miny = MIN(miny, ey);
-        maxy = MAX(maxy, ey);
-        faces += total;
-    } END_MAP_FOR_EACH;
+    }
+    if (g->arena_count == MAX_ARENAS) {
+        return 0;
+    }
+    Arena *arena = g->arenas + g->arena_count;
+    arena_alloc(arena, 10, MAX(ARENA_VERTICES, ARENA_ROUND(count)));
+    chunk->arena = g->arena_count++;
+    chunk->offset = arena_malloc(arena, count);
+    chunk->capacity = ARENA_ROUND(count);
+    return 1;
+}
 
-    // generate geometry
-    GLfloat *data = malloc_faces(10, faces);
-    int offset = 0;
-    MAP_FOR_EACH(map, ex, ey, ez, ew) {
-        if (ew <= 0) {
-            continue;
-        }
-        int x = ex - ox;
-        int y = ey - oy;
-        int z = ez - oz;
-        int f1 = !opaque[XYZ(x - 1, y, z)];
-        int f2 = !opaque[XYZ(x + 1, y, z)];
-        int f3 = !opaque[XYZ(x, y + 1, z)];
-        int f4 = !opaque[XYZ(x, y - 1, z)] && (ey > 0);
-        int f5 = !opaque[XYZ(x, y, z - 1)];
-        int f6 = !opaque[XYZ(x, y, z + 1)];
-        int total = f1 + f2 + f3 + f4 + f5 + f6;
-        if (total == 0) {
-            continue;
-        }
-        char neighbors[27] = {0};
-        char lights[27] = {0};
-        float shades[27] = {0};
-        int index = 0;
-        for (int dx = -1; dx <= 1; dx++) {
-            for (int dy = -1; dy <= 1; dy++) {
-                for (int dz = -1; dz <= 1; dz++) {
-                    neighbors[index] = opaque[XYZ(x + dx, y + dy, z + dz)];
-                    lights[index] = light[XYZ(x + dx, y + dy, z + dz)];
-                    shades[index] = 0;
-                    if (y + dy <= highest[XZ(x + dx, z + dz)]) {
-                        for (int oy = 0; oy < 8; oy++) {
-                            if (opaque[XYZ(x + dx, y + dy + oy, z + dz)]) {
-                                shades[index] = 1.0 - oy * 0.125;
-                                break;
-                            }
-                        }
-                    }
-                    index++;
-                }
-            }
-        }
-        float ao[6][4];
-        float light[6][4];
-        occlusion(neighbors, lights, shades, ao, light);
-        if (is_plant(ew)) {
-            total = 4;
-            float min_ao = 1;
-            float max_light = 0;
-            for (int a = 0; a < 6; a++) {
-                for (int b = 0; b < 4; b++) {
-                    min_ao = MIN(min_ao, ao[a][b]);
-                    max_light = MAX(max_light, light[a][b]);
-                }
-            }
-            float rotation = simplex2(ex, ez, 4, 0.5, 2) * 360;
-            make_plant(
-                data + offset, min_ao, max_light,
-                ex, ey, ez, 0.5, ew, rotation);
-        }
-        else {
-            make_cube(
-                data + offset, ao, light,
-                f1, f2, f3, f4, f5, f6,
-                ex, ey, ez, 0.5, ew);
-        }
-        offset += total * 60;
-    } END_MAP_FOR_EACH;
+// Takes ownership of a finished job's geometry. A mesh that was still
+// waiting for upload is superseded.
+void set_pending_mesh(Chunk *chunk, WorkerItem *item) {
+    Mesh *mesh = &chunk->mesh;
+    if (chunk->pending) {
+        free(mesh->data);
+    }
+    mesh->miny = item->miny;
+    mesh->maxy = item->maxy;
+    mesh->faces = item->faces;
+    mesh->transparent_faces = item->transparent_faces;
+    mesh->data = item->data;
+    item->data = 0;
+    chunk->pending = 1;
+}
 
-    free(opaque);
-    free(light);
-    free(highest);
+void drop_pending_mesh(Chunk *chunk) {
+    if (chunk->pending) {
+        free(chunk->mesh.data);
+        chunk->mesh.data = 0;
+        chunk->pending = 0;
+    }
+}
 
-    item->miny = miny;
-    item->maxy = maxy;
-    item->faces = faces;
-    item->data = data;
+// Moves the pending mesh into the chunk's arena slot and rebuilds the sign
+// buffer. Returns the number of bytes sent to the GPU.
+int upload_pending_mesh(Chunk *chunk) {
+    Mesh *mesh = &chunk->mesh;
+    int count = mesh->faces * 6;
+    chunk->miny = mesh->miny;
+    chunk->maxy = mesh->maxy;
+    chunk->faces = mesh->faces;
+    chunk->transparent_faces = mesh->transparent_faces;
+    chunk->meshed = 1;
+    if (count > chunk->capacity) {
+        release_mesh(chunk);
+        if (count && !alloc_mesh(chunk, count)) {
+            fprintf(stderr, "Chunk arenas full, dropping mesh %d,%d\n",
+                chunk->p, chunk->q);
+            chunk->faces = 0;
+            chunk->transparent_faces = 0;
+        }
+    }
+    else if (!count) {
+        release_mesh(chunk);
+    }
+    int size = 0;
+    if (chunk->faces) {
+        arena_upload(
+            g->arenas + chunk->arena, chunk->offset, count, mesh->data);
+        size = sizeof(GLfloat) * 10 * count;
+    }
+    drop_pending_mesh(chunk);
+    return size + gen_sign_buffer(chunk);
 }
 
 void generate_chunk(Chunk *chunk, WorkerItem *item) {
-    chunk->miny = item->miny;
-    chunk->maxy = item->maxy;
-    chunk->faces = item->faces;
-    del_buffer(chunk->buffer);
-    chunk->buffer = gen_faces(10, item->faces, item->data);
-    gen_sign_buffer(chunk);
+    set_pending_mesh(chunk, item);
+    upload_pending_mesh(chunk);
 }
 
-void gen_chunk_buffer(Chunk *chunk) {
+void queue_chunk_mesh(Chunk *chunk, WorkerItem *item) {
+    if (!chunk->pending && g->ready_count < MAX_CHUNKS) {
+        g->ready_p[g->ready_count] = chunk->p;
+        g->ready_q[g->ready_count] = chunk->q;
+        g->ready_count++;
+        set_pending_mesh(chunk, item);
+    }
+    else if (chunk->pending) {
+        set_pending_mesh(chunk, item);
+    }
+    else {
+        generate_chunk(chunk, item);
+    }
+}
+
+// Uploads queued meshes, nearest visible chunks first (teleport
+// destination before everything), until the per-frame byte or time budget
+// is spent. At least one mesh goes up every frame so the queue drains.
+void upload_chunks() {
+    int count = g->ready_count;
+    if (!count) {
+        return;
+    }
+    static int order[MAX_CHUNKS];
+    Teleport *t = &g->teleport;
+    int tp = chunked(t->state.x);
+    int tq = chunked(t->state.z);
+    Visibility *v = &g->visibility;
+    for (int i = 0; i < count; i++) {
+        int a = g->ready_p[i];
+        int b = g->ready_q[i];
+        int score = MIN(MAX(ABS(a - v->p), ABS(b - v->q)), 0xff);
+        if (!column_visibility(v, a, b)) {
+            score |= 0x100;
+        }
+        if (t->active && MAX(ABS(a - tp), ABS(b - tq)) <= 1) {
+            score = 0;
+        }
+        order[i] = (score << DRAW_INDEX_BITS) | i;
+    }
+    qsort(order, count, sizeof(int), compare_int);
+    double start = glfwGetTime();
+    int bytes = 0;
+    int done = 0;
+    for (; done < count; done++) {
+        if (done && (bytes >= UPLOAD_BUDGET_BYTES ||
+            (glfwGetTime() - start) * 1000 >= UPLOAD_BUDGET_MS))
+        {
+            break;
+        }
+        int i = order[done] & DRAW_INDEX_MASK;
+        Chunk *chunk = find_chunk(g->ready_p[i], g->ready_q[i]);
+        if (chunk && chunk->pending) {
+            trace_begin("upload_mesh");
+            bytes += upload_pending_mesh(chunk);
+            trace_end("upload_mesh");
+            profile_count(COUNTER_UPLOADS, 1);
+        }
+        g->ready_p[i] = INT_MAX;
+    }
+    // compact what is left, keeping queue order
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (g->ready_p[i] != INT_MAX) {
+            g->ready_p[n] = g->ready_p[i];
+            g->ready_q[n] = g->ready_q[i];
+            n++;
+        }
+    }
+    g->ready_count = n;
+    profile_count(COUNTER_UPLOAD_BYTES, bytes / 1024.0);
+}
+
+void gen_chunk_buffer(Chunk *chunk) {
     WorkerItem _item;
     WorkerItem *item = &_item;
     item->p = chunk->p;
     item->q = chunk->q;
+    item->cancelled = 0;
+    item->mtx = 0;
     for (int dp = -1; dp <= 1; dp++) {
         for (int dq = -1; dq <= 1; dq++) {
             Chunk *other = chunk;
             if (dp || dq) {
                 other = find_chunk(chunk->p + dp, chunk->q + dq);
             }
-            if (other) {
+            if (other && other->loaded) {
                 item->block_maps[dp + 1][dq + 1] = &other->map;
                 item->light_maps[dp + 1][dq + 1] = &other->lights;
             }
@@ -1169,28 +1421,96 @@ void map_set_func(int x, int y, int z, int w, void *arg) {
     map_set(map, x, y, z, w);
 }
 
-void load_chunk(WorkerItem *item) {
+int load_chunk(WorkerItem *item) {
     int p = item->p;
     int q = item->q;
     Map *block_map = item->block_maps[1][1];
     Map *light_map = item->light_maps[1][1];
+    item->edges = 0;
     create_world(p, q, map_set_func, block_map);
-    db_load_blocks(block_map, p, q);
+    if (item_cancelled(item)) {
+        return 0;
+    }
+    item->edges = db_load_blocks(block_map, p, q);
+    if (item_cancelled(item)) {
+        return 0;
+    }
     db_load_lights(light_map, p, q);
+    return 1;
+}
+
+int request_compare(const void *a, const void *b) {
+    return ((ChunkRequest *)a)->score - ((ChunkRequest *)b)->score;
+}
+
+// Sends the chunk requests collected since the last call in one go, in
+// the order the workers would pick the chunks, so the server answers for
+// what is in view first.
+void send_chunk_requests() {
+    if (!g->request_count) {
+        return;
+    }
+    State *s = &g->players->state;
+    if (g->teleport.active) {
+        s = &g->teleport.state;
+    }
+    int p = chunked(s->x);
+    int q = chunked(s->z);
+    int count = 0;
+    for (int i = 0; i < g->request_count; i++) {
+        ChunkRequest *request = g->requests + i;
+        if (!find_chunk(request->p, request->q)) {
+            // deleted before it was asked for
+            continue;
+        }
+        int distance = MAX(ABS(request->p - p), ABS(request->q - q));
+        request->score = chunk_score(request->p, request->q, distance, 0);
+        g->requests[count++] = *request;
+    }
+    qsort(g->requests, count, sizeof(ChunkRequest), request_compare);
+    int data[MAX_REQUESTS * 3];
+    for (int i = 0; i < count; i++) {
+        ChunkRequest *request = g->requests + i;
+        data[i * 3 + 0] = request->p;
+        data[i * 3 + 1] = request->q;
+        data[i * 3 + 2] = db_get_key(request->p, request->q);
+    }
+    client_chunks(data, count);
+    g->request_count = 0;
 }
 
 void request_chunk(int p, int q) {
-    int key = db_get_key(p, q);
-    client_chunk(p, q, key);
+    if (!get_client_enabled()) {
+        return;
+    }
+    if (g->request_count == MAX_REQUESTS) {
+        send_chunk_requests();
+    }
+    ChunkRequest *request = g->requests + g->request_count++;
+    request->p = p;
+    request->q = q;
 }
 
 void init_chunk(Chunk *chunk, int p, int q) {
     chunk->p = p;
     chunk->q = q;
+    chunk->generation = ++g->chunk_generation;
+    chunk_hash_insert(chunk);
     chunk->faces = 0;
+    chunk->transparent_faces = 0;
     chunk->sign_faces = 0;
-    chunk->buffer = 0;
+    chunk->meshed = 0;
+    chunk->arena = -1;
+    chunk->offset = 0;
+    chunk->capacity = 0;
     chunk->sign_buffer = 0;
+    chunk->query = 0;
+    chunk->query_pending = 0;
+    chunk->occluded = 0;
+    chunk->seen = 0;
+    chunk->pending = 0;
+    chunk->loaded = 0;
+    chunk->mesh.data = 0;
     dirty_chunk(chunk);
     SignList *signs = &chunk->signs;
     sign_list_alloc(signs, 16);
@@ -1211,23 +1531,46 @@ void create_chunk(Chunk *chunk, int p, int q) {
     WorkerItem *item = &_item;
     item->p = chunk->p;
     item->q = chunk->q;
+    item->cancelled = 0;
+    item->mtx = 0;
     item->block_maps[1][1] = &chunk->map;
     item->light_maps[1][1] = &chunk->lights;
     load_chunk(item);
+    chunk->loaded = 1;
 
     request_chunk(p, q);
 }
 
+void delete_chunk(Chunk *chunk) {
+    map_free(&chunk->map);
+    map_free(&chunk->lights);
+    sign_list_free(&chunk->signs);
+    release_mesh(chunk);
+    drop_pending_mesh(chunk);
+    del_buffer(chunk->sign_buffer);
+    if (chunk->query) {
+        glDeleteQueries(1, &chunk->query);
+    }
+    chunk_hash_remove(chunk->p, chunk->q);
+    Chunk *other = g->chunks + (--g->chunk_count);
+    if (other != chunk) {
+        int i = chunk_hash_find(other->p, other->q);
+        g->chunk_hash[i] = chunk - g->chunks + 1;
+        memcpy(chunk, other, sizeof(Chunk));
+    }
+}
+
 void delete_chunks() {
-    int count = g->chunk_count;
     State *s1 = &g->players->state;
     State *s2 = &(g->players + g->observe1)->state;
     State *s3 = &(g->players + g->observe2)->state;
-    State *states[3] = {s1, s2, s3};
-    for (int i = 0; i < count; i++) {
+    State *s4 = &g->teleport.state;
+    State *states[4] = {s1, s2, s3, s4};
+    int n = g->teleport.active ? 4 : 3;
+    for (int i = 0; i < g->chunk_count; i++) {
         Chunk *chunk = g->chunks + i;
         int delete = 1;
-        for (int j = 0; j < 3; j++) {
+        for (int j = 0; j < n; j++) {
             State *s = states[j];
             int p = chunked(s->x);
             int q = chunked(s->z);
@@ -1237,16 +1580,10 @@ void delete_chunks() {
             }
         }
         if (delete) {
-            map_free(&chunk->map);
-            map_free(&chunk->lights);
-            sign_list_free(&chunk->signs);
-            del_buffer(chunk->buffer);
-            del_buffer(chunk->sign_buffer);
-            Chunk *other = g->chunks + (--count);
-            memcpy(chunk, other, sizeof(Chunk));
+            delete_chunk(chunk);
+            i--;
         }
     }
-    g->chunk_count = count;
 }
 
 void delete_all_chunks() {
@@ -1255,20 +1592,71 @@ void delete_all_chunks() {
         map_free(&chunk->map);
         map_free(&chunk->lights);
         sign_list_free(&chunk->signs);
-        del_buffer(chunk->buffer);
+        release_mesh(chunk);
+        drop_pending_mesh(chunk);
         del_buffer(chunk->sign_buffer);
+        if (chunk->query) {
+            glDeleteQueries(1, &chunk->query);
+        }
     }
     g->chunk_count = 0;
+    g->ready_count = 0;
+    memset(g->chunk_hash, 0, sizeof(g->chunk_hash));
+    for (int i = 0; i < g->arena_count; i++) {
+        arena_free(g->arenas + i);
+    }
+    g->arena_count = 0;
+}
+
+// Snapshots are decoded on the workers in any order but applied in the
+// order they arrived, and parse_lines holds back every other message
+// until they are, so nothing received later is overwritten.
+int dispatch_snapshot(Worker *worker) {
+    for (int i = 0; i < g->snapshot_count; i++) {
+        Snapshot *snapshot = g->snapshots[i];
+        if (snapshot->state == SNAPSHOT_QUEUED) {
+            snapshot->state = SNAPSHOT_BUSY;
+            worker->snapshot = snapshot;
+            worker->state = WORKER_BUSY;
+            cnd_signal(&worker->cnd);
+            return 1;
+        }
+    }
+    return 0;
 }
 
 void check_workers() {
     for (int i = 0; i < WORKERS; i++) {
         Worker *worker = g->workers + i;
         mtx_lock(&worker->mtx);
-        if (worker->state == WORKER_DONE) {
+        if (worker->state == WORKER_DONE && worker->snapshot) {
+            Snapshot *snapshot = worker->snapshot;
+            if (snapshot->state == SNAPSHOT_DROPPED) {
+                snapshot_free(snapshot);
+            }
+            else {
+                snapshot->state = SNAPSHOT_DONE;
+            }
+            worker->snapshot = 0;
+            worker->state = WORKER_IDLE;
+        }
+        else if (worker->state == WORKER_DONE) {
             WorkerItem *item = &worker->item;
             Chunk *chunk = find_chunk(item->p, item->q);
-            if (chunk) {
+            if (chunk && chunk->generation != item->generation) {
+                // deleted and created again since the job started
+                chunk = 0;
+            }
+            if (chunk && item->cancelled) {
+                if (item->load) {
+                    // never loaded, let ensure_chunks create it again
+                    delete_chunk(chunk);
+                }
+                else {
+                    chunk->dirty = 1;
+                }
+            }
+            else if (chunk) {
                 if (item->load) {
                     Map *block_map = item->block_maps[1][1];
                     Map *light_map = item->light_maps[1][1];
@@ -1276,9 +1664,24 @@ void check_workers() {
                     map_free(&chunk->lights);
                     map_copy(&chunk->map, block_map);
                     map_copy(&chunk->lights, light_map);
+                    chunk->loaded = 1;
                     request_chunk(item->p, item->q);
+                    // neighbours meshed so far did not see edits along
+                    // the borders they share with this chunk
+                    for (int dp = -1; dp <= 1; dp++) {
+                        for (int dq = -1; dq <= 1; dq++) {
+                            if (!(item->edges & (1 << ((dp + 1) * 3 + dq + 1)))) {
+                                continue;
+                            }
+                            Chunk *other = find_chunk(
+                                chunk->p + dp, chunk->q + dq);
+                            if (other) {
+                                dirty_chunk(other);
+                            }
+                        }
+                    }
                 }
-                generate_chunk(chunk, item);
+                queue_chunk_mesh(chunk, item);
             }
             for (int a = 0; a < 3; a++) {
                 for (int b = 0; b < 3; b++) {
@@ -1294,6 +1697,8 @@ void check_workers() {
                     }
                 }
             }
+            free(item->data);
+            item->data = 0;
             worker->state = WORKER_IDLE;
         }
         mtx_unlock(&worker->mtx);
@@ -1324,52 +1729,7 @@ void force_chunks(Player *player) {
     }
 }
 
-void ensure_chunks_worker(Player *player, Worker *worker) {
-    State *s = &player->state;
-    float matrix[16];
-    set_matrix_3d(
-        matrix, g->width, g->height,
-        s->x, s->y, s->z, s->rx, s->ry, g->fov, g->ortho, g->render_radius);
-    float planes[6][4];
-    frustum_planes(planes, g->render_radius, matrix);
-    int p = chunked(s->x);
-    int q = chunked(s->z);
-    int r = g->create_radius;
-    int start = 0x0fffffff;
-    int best_score = start;
-    int best_a = 0;
-    int best_b = 0;
-    for (int dp = -r; dp <= r; dp++) {
-        for (int dq = -r; dq <= r; dq++) {
-            int a = p + dp;
-            int b = q + dq;
-            int index = (ABS(a) ^ ABS(b)) % WORKERS;
-            if (index != worker->index) {
-                continue;
-            }
-            Chunk *chunk = find_chunk(a, b);
-            if (chunk && !chunk->dirty) {
-                continue;
-            }
-            int distance = MAX(ABS(dp), ABS(dq));
-            int invisible = !chunk_visible(planes, a, b, 0, 256);
-            int priority = 0;
-            if (chunk) {
-                priority = chunk->buffer && chunk->dirty;
-            }
-            int score = (invisible << 24) | (priority << 16) | distance;
-            if (score < best_score) {
-                best_score = score;
-                best_a = a;
-                best_b = b;
-            }
-        }
-    }
-    if (best_score == start) {
-        return;
-    }
-    int a = best_a;
-    int b = best_b;
+int dispatch_chunk(Worker *worker, int a, int b) {
     int load = 0;
     Chunk *chunk = find_chunk(a, b);
     if (!chunk) {
@@ -1379,20 +1739,23 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
             init_chunk(chunk, a, b);
         }
         else {
-            return;
+            return 0;
         }
     }
     WorkerItem *item = &worker->item;
     item->p = chunk->p;
     item->q = chunk->q;
     item->load = load;
+    item->generation = chunk->generation;
+    item->cancelled = 0;
+    item->mtx = &worker->mtx;
     for (int dp = -1; dp <= 1; dp++) {
         for (int dq = -1; dq <= 1; dq++) {
             Chunk *other = chunk;
             if (dp || dq) {
                 other = find_chunk(chunk->p + dp, chunk->q + dq);
             }
-            if (other) {
+            if (other && (other == chunk || other->loaded)) {
                 Map *block_map = malloc(sizeof(Map));
                 map_copy(block_map, &other->map);
                 Map *light_map = malloc(sizeof(Map));
@@ -1409,35 +1772,277 @@ void ensure_chunks_worker(Player *player, Worker *worker) {
     chunk->dirty = 0;
     worker->state = WORKER_BUSY;
     cnd_signal(&worker->cnd);
+    profile_count(COUNTER_JOBS, 1);
+    return 1;
+}
+
+// Chebyshev distance from chunk (a, b) to the path from (p, q) to (lp, lq)
+int path_distance(int a, int b, int p, int q, int lp, int lq, int steps) {
+    int result = MAX(ABS(a - p), ABS(b - q));
+    for (int i = 1; i <= steps; i++) {
+        int cp = p + (lp - p) * i / steps;
+        int cq = q + (lq - q) * i / steps;
+        result = MIN(result, MAX(ABS(a - cp), ABS(b - cq)));
+    }
+    return result;
+}
+
+// Picks the next chunk for every idle worker in a single scan of the
+// candidate area. Workers own the cells that hash to their index.
+void ensure_chunks_workers(Player *player, int idle) {
+    State *s = &player->state;
+    float x = s->x;
+    float z = s->z;
+    if (g->teleport.active) {
+        x = g->teleport.state.x;
+        z = g->teleport.state.z;
+    }
+    int p = chunked(x);
+    int q = chunked(z);
+    int r = g->create_radius;
+    // extrapolate along the current velocity, staying inside the delete
+    // radius so prefetched chunks are not thrown away right away
+    int limit = MAX(g->delete_radius - 2, 0);
+    int lp = p + MAX(-limit, MIN(limit,
+        chunked(x + g->velocity_x * PREFETCH_SECONDS) - p));
+    int lq = q + MAX(-limit, MIN(limit,
+        chunked(z + g->velocity_z * PREFETCH_SECONDS) - q));
+    int steps = MAX(ABS(lp - p), ABS(lq - q));
+    int pr = steps ? PREFETCH_RADIUS : 0;
+    int start = 0x0fffffff;
+    int best_score[WORKERS];
+    int best_a[WORKERS];
+    int best_b[WORKERS];
+    for (int i = 0; i < WORKERS; i++) {
+        best_score[i] = start;
+    }
+    for (int a = MIN(p - r, lp - pr); a <= MAX(p + r, lp + pr); a++) {
+        for (int b = MIN(q - r, lq - pr); b <= MAX(q + r, lq + pr); b++) {
+            int index = (ABS(a) ^ ABS(b)) % WORKERS;
+            if (!(idle & (1 << index))) {
+                continue;
+            }
+            int distance = MAX(ABS(a - p), ABS(b - q));
+            int path = steps ? path_distance(a, b, p, q, lp, lq, steps) : distance;
+            int ahead = steps && path <= pr;
+            if (distance > r && (!ahead || distance >= g->delete_radius - 1)) {
+                continue;
+            }
+            Chunk *chunk = find_chunk(a, b);
+            if (chunk && !chunk->dirty) {
+                continue;
+            }
+            int priority = 0;
+            if (chunk) {
+                priority = chunk->meshed && chunk->dirty;
+            }
+            int score = chunk_score(a, b, distance, ahead) |
+                (priority << 16);
+            if (score < best_score[index]) {
+                best_score[index] = score;
+                best_a[index] = a;
+                best_b[index] = b;
+            }
+        }
+    }
+    for (int i = 0; i < WORKERS; i++) {
+        if (best_score[i] == start) {
+            continue;
+        }
+        Worker *worker = g->workers + i;
+        mtx_lock(&worker->mtx);
+        dispatch_chunk(worker, best_a[i], best_b[i]);
+        mtx_unlock(&worker->mtx);
+    }
+}
+
+int ensure_teleport_chunks_worker(Worker *worker) {
+    Teleport *t = &g->teleport;
+    if (!t->active) {
+        return 0;
+    }
+    int p = chunked(t->state.x);
+    int q = chunked(t->state.z);
+    for (int r = 0; r <= 1; r++) {
+        for (int dp = -r; dp <= r; dp++) {
+            for (int dq = -r; dq <= r; dq++) {
+                if (MAX(ABS(dp), ABS(dq)) != r) {
+                    continue;
+                }
+                Chunk *chunk = find_chunk(p + dp, q + dq);
+                if (chunk && !chunk->dirty) {
+                    continue;
+                }
+                return dispatch_chunk(worker, p + dp, q + dq);
+            }
+        }
+    }
+    return 0;
+}
+
+// Flags in-flight jobs whose result can no longer be used because the chunk
+// was deleted or recreated. A job for a chunk that was edited again after
+// it started still finishes: its mesh is newer than the one on screen, and
+// cancelling it would keep a chunk under constant edits from ever updating.
+void cancel_stale_jobs() {
+    for (int i = 0; i < WORKERS; i++) {
+        Worker *worker = g->workers + i;
+        mtx_lock(&worker->mtx);
+        WorkerItem *item = &worker->item;
+        if (worker->state == WORKER_BUSY && !worker->snapshot &&
+            !item->cancelled)
+        {
+            Chunk *chunk = find_chunk(item->p, item->q);
+            if (!chunk || chunk->generation != item->generation) {
+                item->cancelled = 1;
+            }
+        }
+        mtx_unlock(&worker->mtx);
+    }
 }
 
 void ensure_chunks(Player *player) {
+    cancel_stale_jobs();
     check_workers();
     force_chunks(player);
+    int idle = 0;
     for (int i = 0; i < WORKERS; i++) {
         Worker *worker = g->workers + i;
         mtx_lock(&worker->mtx);
         if (worker->state == WORKER_IDLE) {
-            ensure_chunks_worker(player, worker);
+            if (!dispatch_snapshot(worker) &&
+                !ensure_teleport_chunks_worker(worker))
+            {
+                idle |= 1 << i;
+            }
+        }
+        mtx_unlock(&worker->mtx);
+    }
+    if (idle) {
+        ensure_chunks_workers(player, idle);
+    }
+    send_chunk_requests();
+}
+
+void begin_teleport(float x, float y, float z, float rx, float ry) {
+    Teleport *t = &g->teleport;
+    t->active = 1;
+    t->state.x = x;
+    t->state.y = y;
+    t->state.z = z;
+    t->state.rx = rx;
+    t->state.ry = ry;
+    t->start = replay_time();
+    // jobs that will not survive the move are wasted work
+    int p = chunked(x);
+    int q = chunked(z);
+    for (int i = 0; i < WORKERS; i++) {
+        Worker *worker = g->workers + i;
+        mtx_lock(&worker->mtx);
+        if (worker->state == WORKER_BUSY && !worker->snapshot) {
+            WorkerItem *item = &worker->item;
+            int distance = MAX(ABS(item->p - p), ABS(item->q - q));
+            if (distance >= g->delete_radius) {
+                item->cancelled = 1;
+            }
         }
         mtx_unlock(&worker->mtx);
     }
 }
 
+void update_velocity(double dt) {
+    State *s = &g->players->state;
+    float dx = s->x - g->last_x;
+    float dz = s->z - g->last_z;
+    g->last_x = s->x;
+    g->last_z = s->z;
+    if (dt <= 0) {
+        return;
+    }
+    if (ABS(dx) > CHUNK_SIZE * 4 || ABS(dz) > CHUNK_SIZE * 4) {
+        // a jump, not movement
+        g->velocity_x = 0;
+        g->velocity_z = 0;
+        return;
+    }
+    float alpha = MIN(dt * 4, 1);
+    g->velocity_x += (dx / dt - g->velocity_x) * alpha;
+    g->velocity_z += (dz / dt - g->velocity_z) * alpha;
+}
+
+void update_teleport() {
+    Teleport *t = &g->teleport;
+    if (!t->active) {
+        return;
+    }
+    int p = chunked(t->state.x);
+    int q = chunked(t->state.z);
+    int ready = 1;
+    for (int dp = -1; dp <= 1; dp++) {
+        for (int dq = -1; dq <= 1; dq++) {
+            Chunk *chunk = find_chunk(p + dp, q + dq);
+            if (!chunk || !chunk->meshed) {
+                ready = 0;
+            }
+        }
+    }
+    if (!ready && replay_time() - t->start < TELEPORT_TIMEOUT) {
+        return;
+    }
+    Player *me = g->players;
+    State *s = &me->state;
+    s->x = t->state.x;
+    s->y = t->state.y;
+    s->z = t->state.z;
+    s->rx = t->state.rx;
+    s->ry = t->state.ry;
+    t->active = 0;
+    g->velocity_x = 0;
+    g->velocity_z = 0;
+    g->last_x = s->x;
+    g->last_z = s->z;
+    if (s->y == 0) {
+        force_chunks(me);
+        s->y = highest_block(s->x, s->z) + 2;
+    }
+}
+
 int worker_run(void *arg) {
     Worker *worker = (Worker *)arg;
-    int running = 1;
-    while (running) {
+    char name[32];
+    snprintf(name, sizeof(name), "worker %d", worker->index);
+    trace_thread(name);
+    while (1) {
         mtx_lock(&worker->mtx);
-        while (worker->state != WORKER_BUSY) {
+        while (worker->state != WORKER_BUSY && !worker->exit) {
             cnd_wait(&worker->cnd, &worker->mtx);
         }
+        if (worker->state != WORKER_BUSY) {
+            mtx_unlock(&worker->mtx);
+            break;
+        }
         mtx_unlock(&worker->mtx);
+        if (worker->snapshot) {
+            trace_begin("decode_snapshot");
+            snapshot_decode(worker->snapshot);
+            trace_end("decode_snapshot");
+            mtx_lock(&worker->mtx);
+            worker->state = WORKER_DONE;
+            mtx_unlock(&worker->mtx);
+            continue;
+        }
         WorkerItem *item = &worker->item;
+        int loaded = 1;
         if (item->load) {
-            load_chunk(item);
+            trace_begin("load_chunk");
+            loaded = load_chunk(item);
+            trace_end("load_chunk");
+        }
+        if (loaded) {
+            trace_begin("compute_chunk");
+            compute_chunk(item);
+            trace_end("compute_chunk");
         }
-        compute_chunk(item);
         mtx_lock(&worker->mtx);
         worker->state = WORKER_DONE;
         mtx_unlock(&worker->mtx);
@@ -1445,6 +2050,25 @@ int worker_run(void *arg) {
     return 0;
 }
 
+// Cancels the jobs in flight and waits for the workers to exit, so none of
+// them is still tracing or touching a snapshot when those are torn down.
+void stop_workers() {
+    for (int i = 0; i < WORKERS; i++) {
+        Worker *worker = g->workers + i;
+        mtx_lock(&worker->mtx);
+        worker->exit = 1;
+        worker->item.cancelled = 1;
+        cnd_signal(&worker->cnd);
+        mtx_unlock(&worker->mtx);
+    }
+    for (int i = 0; i < WORKERS; i++) {
+        Worker *worker = g->workers + i;
+        thrd_join(worker->thrd, NULL);
+        cnd_destroy(&worker->cnd);
+        mtx_destroy(&worker->mtx);
+    }
+}
+
 void unset_sign(int x, int y, int z) {
     int p = chunked(x);
     int q = chunked(z);
@@ -1554,20 +2178,7 @@ void set_block(int x, int y, int z, int w) {
     int p = chunked(x);
     int q = chunked(z);
     _set_block(p, q, x, y, z, w, 1);
-    for (int dx = -1; dx <= 1; dx++) {
-        for (int dz = -1; dz <= 1; dz++) {
-            if (dx == 0 && dz == 0) {
-                continue;
-            }
-            if (dx && chunked(x + dx) == p) {
-                continue;
-            }
-            if (dz && chunked(z + dz) == q) {
-                continue;
-            }
-            _set_block(p + dx, q + dz, x, y, z, -w, 1);
-        }
-    }
+    dirty_neighbors(x, z);
     client_block(x, y, z, w);
 }
 
@@ -1623,21 +2234,53 @@ void builder_block_glowing(int x, int y, int z, int w) {
     }
 }
 
+// Folds in the chunk's last finished occlusion query and returns whether
+// it needs a new one. Results are a frame or more old, so chunks that just
+// entered the view or sit next to the camera are always treated as visible.
+int update_occlusion(Chunk *chunk, int frame, int distance) {
+    if (chunk->query_pending) {
+        GLuint available;
+        glGetQueryObjectuiv(
+            chunk->query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint samples;
+            glGetQueryObjectuiv(chunk->query, GL_QUERY_RESULT, &samples);
+            chunk->occluded = samples == 0;
+            chunk->query_pending = 0;
+        }
+    }
+    int fresh = chunk->seen != frame - 1;
+    chunk->seen = frame;
+    if (distance <= 1) {
+        chunk->occluded = 0;
+        return 0;
+    }
+    if (fresh) {
+        chunk->occluded = 0;
+        return !chunk->query_pending;
+    }
+    if (chunk->query_pending) {
+        return 0;
+    }
+    // hidden chunks are rechecked every frame, visible ones now and then
+    return chunk->occluded ||
+        (frame + chunk->generation) % OCCLUSION_INTERVAL == 0;
+}
+
 int render_chunks(Attrib *attrib, Player *player) {
     int result = 0;
     State *s = &player->state;
+    Visibility *v = g->view;
+    update_visibility(v, player);
+    profile_begin(PHASE_ENSURE);
+    trace_begin("ensure_chunks");
     ensure_chunks(player);
-    int p = chunked(s->x);
-    int q = chunked(s->z);
+    trace_end("ensure_chunks");
+    profile_end(PHASE_ENSURE);
+    profile_begin(PHASE_CHUNKS);
     float light = get_daylight();
-    float matrix[16];
-    set_matrix_3d(
-        matrix, g->width, g->height,
-        s->x, s->y, s->z, s->rx, s->ry, g->fov, g->ortho, g->render_radius);
-    float planes[6][4];
-    frustum_planes(planes, g->render_radius, matrix);
     glUseProgram(attrib->program);
-    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
+    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, v->matrix);
     glUniform3f(attrib->camera, s->x, s->y, s->z);
     glUniform1i(attrib->sampler, 0);
     glUniform1i(attrib->extra1, 2);
@@ -1649,44 +2292,128 @@ int render_chunks(Attrib *attrib, Player *player) {
 #endif
     glUniform1i(attrib->extra4, g->ortho);
     glUniform1f(attrib->timer, time_of_day());
-    for (int i = 0; i < g->chunk_count; i++) {
-        Chunk *chunk = g->chunks + i;
-        if (chunk_distance(chunk, p, q) > g->render_radius) {
+    int occlusion = OCCLUSION_CULLING && GLEW_VERSION_1_5 &&
+        player == g->players + g->observe1;
+    // the inset view would break frame to frame coherence, so only the
+    // main view takes part
+    int frame = occlusion ? ++v->frame : v->frame;
+    v->query_count = 0;
+    v->draw_count = 0;
+    for (int i = 0; i < v->count; i++) {
+        Chunk *chunk = find_chunk(v->cell_p[i], v->cell_q[i]);
+        if (!chunk || !chunk->faces) {
             continue;
         }
-        if (!chunk_visible(
-            planes, chunk->p, chunk->q, chunk->miny, chunk->maxy))
-        {
+        int distance = chunk_distance(chunk, v->p, v->q);
+        if (distance > g->render_radius) {
+            continue;
+        }
+        if (!chunk_visible(chunk)) {
             continue;
         }
-        draw_chunk(attrib, chunk);
+        if (occlusion) {
+            if (update_occlusion(chunk, frame, distance)) {
+                v->queries[v->query_count++] = chunk - g->chunks;
+            }
+            if (chunk->occluded) {
+                continue;
+            }
+        }
+        // sort key: squared chunk distance above the chunk index
+        int dp = chunk->p - v->p;
+        int dq = chunk->q - v->q;
+        v->draws[v->draw_count++] =
+            ((dp * dp + dq * dq) << DRAW_INDEX_BITS) | (chunk - g->chunks);
         result += chunk->faces;
     }
+    qsort(v->draws, v->draw_count, sizeof(int), compare_int);
+    // opaque geometry front to back so early depth rejection culls most of
+    // what is behind it, then the alpha tested geometry on top
+    for (int i = 0; i < v->draw_count; i++) {
+        Chunk *chunk = g->chunks + (v->draws[i] & DRAW_INDEX_MASK);
+        int faces = chunk->faces - chunk->transparent_faces;
+        if (faces) {
+            arena_batch_add(g->arenas + chunk->arena,
+                chunk->offset, faces * 6);
+        }
+    }
+    draw_arenas(attrib);
+    for (int i = 0; i < v->draw_count; i++) {
+        Chunk *chunk = g->chunks + (v->draws[i] & DRAW_INDEX_MASK);
+        int faces = chunk->faces - chunk->transparent_faces;
+        if (chunk->transparent_faces) {
+            arena_batch_add(g->arenas + chunk->arena,
+                chunk->offset + faces * 6, chunk->transparent_faces * 6);
+        }
+    }
+    draw_arenas(attrib);
+    profile_end(PHASE_CHUNKS);
     return result;
 }
 
-void render_signs(Attrib *attrib, Player *player) {
-    State *s = &player->state;
-    int p = chunked(s->x);
-    int q = chunked(s->z);
-    float matrix[16];
-    set_matrix_3d(
-        matrix, g->width, g->height,
-        s->x, s->y, s->z, s->rx, s->ry, g->fov, g->ortho, g->render_radius);
-    float planes[6][4];
-    frustum_planes(planes, g->render_radius, matrix);
+// Draws the bounding boxes queued by render_chunks against the depth
+// buffer it just filled, without touching color or depth.
+void render_occlusion_queries(Attrib *attrib) {
+    Visibility *v = g->view;
+    int count = v->query_count;
+    if (!count) {
+        return;
+    }
+    GLfloat *data = malloc(sizeof(GLfloat) * 108 * count);
+    for (int i = 0; i < count; i++) {
+        Chunk *chunk = g->chunks + v->queries[i];
+        float x = chunk->p * CHUNK_SIZE - 1;
+        float z = chunk->q * CHUNK_SIZE - 1;
+        float d = CHUNK_SIZE + 1;
+        make_box(data + i * 108,
+            x, chunk->miny - 1, z, x + d, chunk->maxy + 1, z + d);
+    }
+    int offset = stream_write(
+        &g->stream, sizeof(GLfloat) * 108 * count, data);
+    free(data);
     glUseProgram(attrib->program);
-    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
+    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, v->matrix);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+    glBindBuffer(GL_ARRAY_BUFFER, g->stream.buffer);
+    glEnableVertexAttribArray(attrib->position);
+    glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE, 0,
+        (GLvoid *)(size_t)offset);
+    for (int i = 0; i < count; i++) {
+        Chunk *chunk = g->chunks + v->queries[i];
+        if (!chunk->query) {
+            glGenQueries(1, &chunk->query);
+        }
+        glBeginQuery(GL_SAMPLES_PASSED, chunk->query);
+        glDrawArrays(GL_TRIANGLES, i * 36, 36);
+        glEndQuery(GL_SAMPLES_PASSED);
+        chunk->query_pending = 1;
+    }
+    glDisableVertexAttribArray(attrib->position);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glEnable(GL_CULL_FACE);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    v->query_count = 0;
+}
+
+// uses the visibility pass from the preceding render_chunks call
+void render_signs(Attrib *attrib) {
+    Visibility *v = g->view;
+    glUseProgram(attrib->program);
+    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, v->matrix);
     glUniform1i(attrib->sampler, 3);
     glUniform1i(attrib->extra1, 1);
-    for (int i = 0; i < g->chunk_count; i++) {
-        Chunk *chunk = g->chunks + i;
-        if (chunk_distance(chunk, p, q) > g->sign_radius) {
+    for (int i = 0; i < v->count; i++) {
+        Chunk *chunk = find_chunk(v->cell_p[i], v->cell_q[i]);
+        if (!chunk || !chunk->sign_faces) {
             continue;
         }
-        if (!chunk_visible(
-            planes, chunk->p, chunk->q, chunk->miny, chunk->maxy))
-        {
+        if (chunk_distance(chunk, v->p, v->q) > g->sign_radius) {
+            continue;
+        }
+        if (!chunk_visible(chunk)) {
             continue;
         }
         draw_signs(attrib, chunk);
@@ -1715,9 +2442,9 @@ void render_sign(Attrib *attrib, Player *player) {
     text[MAX_SIGN_LENGTH - 1] = '\0';
     GLfloat *data = malloc_faces(5, strlen(text));
     int length = _gen_sign_buffer(data, x, y, z, face, text);
-    GLuint buffer = gen_faces(5, length, data);
-    draw_sign(attrib, buffer, length);
-    del_buffer(buffer);
+    int offset = stream_faces(5, length, data);
+    free(data);
+    draw_sign(attrib, g->stream.buffer, offset, length);
 }
 
 void render_players(Attrib *attrib, Player *player) {
@@ -1737,6 +2464,9 @@ void render_players(Attrib *attrib, Player *player) {
             draw_player(attrib, other);
         }
     }
+    float identity[16];
+    mat_identity(identity);
+    glUniformMatrix4fv(attrib->model, 1, GL_FALSE, identity);
 }
 
 void render_sky(Attrib *attrib, Player *player, GLuint buffer) {
@@ -1765,9 +2495,10 @@ void render_wireframe(Attrib *attrib, Player *player) {
         glLineWidth(1);
         glEnable(GL_COLOR_LOGIC_OP);
         glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
-        GLuint wireframe_buffer = gen_wireframe_buffer(hx, hy, hz, 0.53);
-        draw_lines(attrib, wireframe_buffer, 3, 24);
-        del_buffer(wireframe_buffer);
+        float data[72];
+        make_cube_wireframe(data, hx, hy, hz, 0.53);
+        int offset = stream_write(&g->stream, sizeof(data), data);
+        draw_lines(attrib, g->stream.buffer, offset, 3, 24);
         glDisable(GL_COLOR_LOGIC_OP);
     }
 }
@@ -1779,9 +2510,15 @@ void render_crosshairs(Attrib *attrib) {
     glLineWidth(4 * g->scale);
     glEnable(GL_COLOR_LOGIC_OP);
     glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
-    GLuint crosshair_buffer = gen_crosshair_buffer();
-    draw_lines(attrib, crosshair_buffer, 2, 4);
-    del_buffer(crosshair_buffer);
+    int x = g->width / 2;
+    int y = g->height / 2;
+    int p = 10 * g->scale;
+    float data[] = {
+        x, y - p, x, y + p,
+        x - p, y, x + p, y
+    };
+    int offset = stream_write(&g->stream, sizeof(data), data);
+    draw_lines(attrib, g->stream.buffer, offset, 2, 4);
     glDisable(GL_COLOR_LOGIC_OP);
 }
 
@@ -1794,32 +2531,59 @@ void render_item(Attrib *attrib) {
     glUniform1i(attrib->sampler, 0);
     glUniform1f(attrib->timer, time_of_day());
     int w = items[g->item_index];
+    GLfloat data[6 * 10 * 6];
     if (is_plant(w)) {
-        GLuint buffer = gen_plant_buffer(0, 0, 0, 0.5, w);
-        draw_plant(attrib, buffer);
-        del_buffer(buffer);
+        make_plant(data, 0, 1, 0, 0, 0, 0.5, w, 45);
+        int offset = stream_faces(10, 4, data);
+        draw_plant(attrib, g->stream.buffer, offset);
     }
     else {
-        GLuint buffer = gen_cube_buffer(0, 0, 0, 0.5, w);
-        draw_cube(attrib, buffer);
-        del_buffer(buffer);
+        float ao[6][4] = {0};
+        float light[6][4] = {
+            {0.5, 0.5, 0.5, 0.5},
+            {0.5, 0.5, 0.5, 0.5},
+            {0.5, 0.5, 0.5, 0.5},
+            {0.5, 0.5, 0.5, 0.5},
+            {0.5, 0.5, 0.5, 0.5},
+            {0.5, 0.5, 0.5, 0.5}
+        };
+        make_cube(data, ao, light, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0.5, w);
+        int offset = stream_faces(10, 6, data);
+        draw_cube(attrib, g->stream.buffer, offset);
+    }
+}
+
+// Queues a line of HUD text. Everything queued is drawn with a single
+// call by flush_text.
+void render_text(int justify, float x, float y, float n, char *text) {
+    int length = strlen(text);
+    if (g->text_length + length > g->text_capacity) {
+        g->text_capacity = MAX(g->text_capacity * 2, g->text_length + length);
+        g->text_data = (GLfloat *)realloc(g->text_data,
+            sizeof(GLfloat) * 24 * g->text_capacity);
+    }
+    x -= n * justify * (length - 1) / 2;
+    GLfloat *data = g->text_data + g->text_length * 24;
+    for (int i = 0; i < length; i++) {
+        make_character(data + i * 24, x, y, n / 2, n, text[i]);
+        x += n;
     }
+    g->text_length += length;
 }
 
-void render_text(
-    Attrib *attrib, int justify, float x, float y, float n, char *text)
-{
+void flush_text(Attrib *attrib) {
+    if (!g->text_length) {
+        return;
+    }
     float matrix[16];
     set_matrix_2d(matrix, g->width, g->height);
     glUseProgram(attrib->program);
     glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
     glUniform1i(attrib->sampler, 1);
     glUniform1i(attrib->extra1, 0);
-    int length = strlen(text);
-    x -= n * justify * (length - 1) / 2;
-    GLuint buffer = gen_text_buffer(x, y, n, text);
-    draw_text(attrib, buffer, length);
-    del_buffer(buffer);
+    int offset = stream_faces(4, g->text_length, g->text_data);
+    draw_text(attrib, g->stream.buffer, offset, g->text_length);
+    g->text_length = 0;
 }
 
 void add_message(const char *text) {
@@ -2039,6 +2803,10 @@ void tree(Block *block) {
     }
 }
 
+// Results of the last /bsearch, used by /bjump
+static BibleSearchResult search_results[MAX_SEARCH_RESULTS];
+static int search_result_count = 0;
+
 void parse_command(const char *buffer, int forward) {
     char username[128] = {0};
     char token[128] = {0};
@@ -2489,21 +3257,18 @@ void parse_command(const char *buffer, int forward) {
 
         // If no arguments, teleport to info area
         if (strlen(args) == 0) {
-            State *s = &g->players->state;
-
             printf("DEBUG: /bgoto with no args - teleporting to info area\n");
 
-            // Try to get INFO position from database
+            // Look up INFO position (mirrored from the database at startup)
             int pos_x = 0, pos_y = 0, pos_z = 0;
-            int found_position = db_get_bible_position("INFO", -1, 0, &pos_x, &pos_y, &pos_z);
+            int found_position = bible_get_position("INFO", -1, 0, &pos_x, &pos_y, &pos_z);
 
             if (found_position) {
                 // Use precise position from database (ONLY database, no math!)
-                s->x = pos_x;
-                s->y = pos_y + 106;  // 106 blocks above text (4 blocks above platform)
-                s->z = pos_z;        // Right at the start of text
-                s->rx = 0;           // Look forward (along +Z)
-                s->ry = -45;         // Look down at text far below
+                // 106 blocks above text (4 blocks above platform), looking
+                // forward (along +Z) and down at the text far below
+                begin_teleport(pos_x, pos_y + 106, pos_z, 0, -45);
+                State *s = &g->teleport.state;
 
                 char coord_msg[256];
                 snprintf(coord_msg, sizeof(coord_msg),
@@ -2618,14 +3383,13 @@ void parse_command(const char *buffer, int forward) {
             }
 
             // Validation passed - proceed with teleport
-            State *s = &g->players->state;
             int pos_x = 0, pos_y = 0, pos_z = 0;
             int found_position = 0;
 
-            // Try to get precise position from database
+            // Look up precise position (mirrored from the database at startup)
             if (verse > 0) {
                 // Look up exact verse position
-                found_position = db_get_bible_position(bible_books[book_index], chapter, verse, &pos_x, &pos_y, &pos_z);
+                found_position = bible_get_position(bible_books[book_index], chapter, verse, &pos_x, &pos_y, &pos_z);
                 printf("/bgoto: Looking up '%s' %d:%d - %s\n", bible_books[book_index], chapter, verse,
                        found_position ? "FOUND" : "NOT FOUND");
                 if (found_position) {
@@ -2633,7 +3397,7 @@ void parse_command(const char *buffer, int forward) {
                 }
             } else if (chapter > 0) {
                 // Look up chapter start (verse 0)
-                found_position = db_get_bible_position(bible_books[book_index], chapter, 0, &pos_x, &pos_y, &pos_z);
+                found_position = bible_get_position(bible_books[book_index], chapter, 0, &pos_x, &pos_y, &pos_z);
                 printf("/bgoto: Looking up '%s' %d:0 - %s\n", bible_books[book_index], chapter,
                        found_position ? "FOUND" : "NOT FOUND");
                 if (found_position) {
@@ -2641,7 +3405,7 @@ void parse_command(const char *buffer, int forward) {
                 }
             } else {
                 // Look up book start (chapter 0, verse 0)
-                found_position = db_get_bible_position(bible_books[book_index], 0, 0, &pos_x, &pos_y, &pos_z);
+                found_position = bible_get_position(bible_books[book_index], 0, 0, &pos_x, &pos_y, &pos_z);
                 printf("/bgoto: Looking up '%s' 0:0 - %s\n", bible_books[book_index],
                        found_position ? "FOUND" : "NOT FOUND");
                 if (found_position) {
@@ -2653,11 +3417,10 @@ void parse_command(const char *buffer, int forward) {
 
             if (found_position) {
                 // Use precise position from database (ONLY database, no math!)
-                s->x = pos_x;
-                s->y = pos_y + 106;         // 106 blocks above text (4 blocks above platform)
-                s->z = pos_z;               // Right at the start of the text
-                s->rx = 0;   // Look south (along +Z axis, toward text)
-                s->ry = -45; // Look down at text far below
+                // 106 blocks above text (4 blocks above platform), looking
+                // south (along +Z axis) and down at the text far below
+                begin_teleport(pos_x, pos_y + 106, pos_z, 0, -45);
+                State *s = &g->teleport.state;
 
                 printf("/bgoto: Teleported to database position: (%d, %d, %d)\n", (int)s->x, (int)s->y, (int)s->z);
 
@@ -2705,11 +3468,108 @@ void parse_command(const char *buffer, int forward) {
             add_message("Book not found! Use /bgoto to see all books.");
         }
     }
+    else if (strncmp(buffer, "/bsearch", 8) == 0 &&
+        (buffer[8] == ' ' || buffer[8] == '\0'))
+    {
+        // Full-text search: /bsearch WORD [WORD ...]
+        // Lists verses containing every word; /bjump N teleports to a result
+        const char *query = buffer + 8;
+        while (*query == ' ') query++;
+        if (*query == '\0') {
+            add_message("Usage: /bsearch WORD [WORD ...]");
+            return;
+        }
+        double start = glfwGetTime();
+        int count = bible_search(query, search_results, MAX_SEARCH_RESULTS);
+        double elapsed = glfwGetTime() - start;
+        search_result_count = MIN(count, MAX_SEARCH_RESULTS);
+        char msg[MAX_TEXT_LENGTH];
+        snprintf(msg, sizeof(msg), "%d verses match \"%s\" (%.3f ms)",
+            count, query, elapsed * 1000);
+        add_message(msg);
+        for (int i = 0; i < search_result_count; i++) {
+            BibleSearchResult *r = search_results + i;
+            int px, py, pz;
+            if (bible_get_position(r->book, r->chapter, r->verse,
+                &px, &py, &pz))
+            {
+                snprintf(msg, sizeof(msg), "%d. %s %d:%d (%d, %d, %d) %.40s",
+                    i + 1, r->book, r->chapter, r->verse, px, py, pz, r->text);
+            }
+            else {
+                snprintf(msg, sizeof(msg), "%d. %s %d:%d %.40s",
+                    i + 1, r->book, r->chapter, r->verse, r->text);
+            }
+            add_message(msg);
+        }
+        if (search_result_count > 0) {
+            add_message("Use /bjump N to teleport to a result");
+        }
+    }
+    else if (sscanf(buffer, "/bjump %d", &count) == 1) {
+        if (count < 1 || count > search_result_count) {
+            add_message("No such search result. Run /bsearch first.");
+            return;
+        }
+        BibleSearchResult *r = search_results + count - 1;
+        char command[MAX_TEXT_LENGTH];
+        snprintf(command, sizeof(command), "/bgoto %s %d:%d",
+            r->book, r->chapter, r->verse);
+        parse_command(command, forward);
+    }
+    else if (strcmp(buffer, "/stats") == 0) {
+        g->show_stats = !g->show_stats;
+    }
+    else if (strcmp(buffer, "/trace start") == 0) {
+        trace_start();
+        add_message("Tracing started, /trace stop [FILE] to save");
+    }
+    else if (strncmp(buffer, "/trace stop", 11) == 0) {
+        char path[MAX_PATH_LENGTH] = "craft-trace.json";
+        sscanf(buffer + 11, " %255s", path);
+        if (!trace_active()) {
+            add_message("Tracing is not running");
+        }
+        else {
+            int count = trace_stop(path);
+            char message[MAX_TEXT_LENGTH];
+            if (count < 0) {
+                snprintf(message, MAX_TEXT_LENGTH,
+                    "Could not write %s", path);
+            }
+            else {
+                snprintf(message, MAX_TEXT_LENGTH,
+                    "Wrote %d trace events to %s", count, path);
+            }
+            add_message(message);
+        }
+    }
+    else if (strcmp(buffer, "/blist") == 0) {
+        // List the verses nearest to the player
+        if (get_client_enabled()) {
+            client_talk(buffer);
+            return;
+        }
+        State *s = &g->players->state;
+        BiblePositionResult nearby[MAX_SEARCH_RESULTS];
+        int n = bible_find_nearby(
+            roundf(s->x), roundf(s->z), nearby, MAX_SEARCH_RESULTS);
+        if (n == 0) {
+            add_message("No verses found. The Bible has not been generated yet.");
+            return;
+        }
+        char msg[MAX_TEXT_LENGTH];
+        for (int i = 0; i < n; i++) {
+            snprintf(msg, sizeof(msg), "%s %d:%d (%d, %d, %d)",
+                nearby[i].book, nearby[i].chapter, nearby[i].verse,
+                nearby[i].x, nearby[i].y, nearby[i].z);
+            add_message(msg);
+        }
+    }
     else if (strncmp(buffer, "/daily", 6) == 0) {
         // Teleport to daily reading
         // Usage: /daily [day_number]
         // If no day number provided, use today's date
-        State *s = &g->players->state;
         int day_of_year;
 
         // Check if a day number was provided
@@ -2771,11 +3631,9 @@ void parse_command(const char *buffer, int forward) {
         }
 
         // Database lookup successful - teleport!
-        s->x = DAILY_READING_X;
-        s->y = DAILY_READING_Y + 106;
-        s->z = z_offset;
-        s->rx = 0;   // Look south (along +Z axis)
-        s->ry = -45; // Look down at text
+        // Look south (along +Z axis) and down at the text
+        begin_teleport(DAILY_READING_X, DAILY_READING_Y + 106, z_offset, 0, -45);
+        State *s = &g->teleport.state;
 
         printf("/daily: Teleporting to (%d, %d, %d)\n", (int)s->x, (int)s->y, (int)s->z);
 
@@ -2851,6 +3709,11 @@ void on_middle_click() {
 }
 
 void on_key(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    ReplayEvent event = {
+        .type = REPLAY_KEY, .a = key, .b = scancode, .c = action, .d = mods};
+    if (!replay_input(&event)) {
+        return;
+    }
     int control = mods & (GLFW_MOD_CONTROL | GLFW_MOD_SUPER);
     int exclusive =
         glfwGetInputMode(window, GLFW_CURSOR) == GLFW_CURSOR_DISABLED;
@@ -2954,7 +3817,7 @@ void on_key(GLFWwindow *window, int key, int scancode, int action, int mods) {
         }
     }
     if (control && key == 'V') {
-        const char *buffer = glfwGetClipboardString(window);
+        const char *buffer = replay_clipboard(window);
         if (g->typing) {
             g->suppress_char = 1;
             // Insert clipboard text at cursor position
@@ -3005,6 +3868,10 @@ void on_key(GLFWwindow *window, int key, int scancode, int action, int mods) {
 }
 
 void on_char(GLFWwindow *window, unsigned int u) {
+    ReplayEvent event = {.type = REPLAY_CHAR, .a = u};
+    if (!replay_input(&event)) {
+        return;
+    }
     if (g->suppress_char) {
         g->suppress_char = 0;
         return;
@@ -3045,6 +3912,10 @@ void on_char(GLFWwindow *window, unsigned int u) {
 }
 
 void on_scroll(GLFWwindow *window, double xdelta, double ydelta) {
+    ReplayEvent event = {.type = REPLAY_SCROLL, .x = xdelta, .y = ydelta};
+    if (!replay_input(&event)) {
+        return;
+    }
     static double ypos = 0;
     ypos += ydelta;
     if (ypos < -SCROLL_THRESHOLD) {
@@ -3061,6 +3932,11 @@ void on_scroll(GLFWwindow *window, double xdelta, double ydelta) {
 }
 
 void on_mouse_button(GLFWwindow *window, int button, int action, int mods) {
+    ReplayEvent event = {
+        .type = REPLAY_BUTTON, .a = button, .b = action, .c = mods};
+    if (!replay_input(&event)) {
+        return;
+    }
     int control = mods & (GLFW_MOD_CONTROL | GLFW_MOD_SUPER);
     int exclusive =
         glfwGetInputMode(window, GLFW_CURSOR) == GLFW_CURSOR_DISABLED;
@@ -3097,6 +3973,27 @@ void on_mouse_button(GLFWwindow *window, int button, int action, int mods) {
     }
 }
 
+// Feeds the recorded input of the current frame through the callbacks.
+void replay_events() {
+    ReplayEvent e;
+    while (replay_next_event(&e)) {
+        switch (e.type) {
+            case REPLAY_KEY:
+                on_key(g->window, e.a, e.b, e.c, e.d);
+                break;
+            case REPLAY_CHAR:
+                on_char(g->window, e.a);
+                break;
+            case REPLAY_BUTTON:
+                on_mouse_button(g->window, e.a, e.b, e.c);
+                break;
+            case REPLAY_SCROLL:
+                on_scroll(g->window, e.x, e.y);
+                break;
+        }
+    }
+}
+
 void create_window() {
     int window_width = WINDOW_WIDTH;
     int window_height = WINDOW_HEIGHT;
@@ -3113,14 +4010,13 @@ void create_window() {
 }
 
 void handle_mouse_input() {
-    int exclusive =
-        glfwGetInputMode(g->window, GLFW_CURSOR) == GLFW_CURSOR_DISABLED;
+    int exclusive = replay_get_exclusive(g->window);
     static double px = 0;
     static double py = 0;
     State *s = &g->players->state;
     if (exclusive && (px || py)) {
         double mx, my;
-        glfwGetCursorPos(g->window, &mx, &my);
+        replay_get_cursor(g->window, &mx, &my);
         float m = 0.0025;
         s->rx += (mx - px) * m;
         if (INVERT_MOUSE) {
@@ -3141,7 +4037,7 @@ void handle_mouse_input() {
         py = my;
     }
     else {
-        glfwGetCursorPos(g->window, &px, &py);
+        replay_get_cursor(g->window, &px, &py);
     }
 }
 
@@ -3152,21 +4048,21 @@ void handle_movement(double dt) {
     int sx = 0;
     if (!g->typing) {
         float m = dt * 1.0;
-        g->ortho = glfwGetKey(g->window, CRAFT_KEY_ORTHO) ? 64 : 0;
-        g->fov = glfwGetKey(g->window, CRAFT_KEY_ZOOM) ? 15 : 65;
-        if (glfwGetKey(g->window, CRAFT_KEY_FORWARD)) sz--;
-        if (glfwGetKey(g->window, CRAFT_KEY_BACKWARD)) sz++;
-        if (glfwGetKey(g->window, CRAFT_KEY_LEFT)) sx--;
-        if (glfwGetKey(g->window, CRAFT_KEY_RIGHT)) sx++;
-        if (glfwGetKey(g->window, GLFW_KEY_LEFT)) s->rx -= m;
-        if (glfwGetKey(g->window, GLFW_KEY_RIGHT)) s->rx += m;
-        if (glfwGetKey(g->window, GLFW_KEY_UP)) s->ry += m;
-        if (glfwGetKey(g->window, GLFW_KEY_DOWN)) s->ry -= m;
+        g->ortho = replay_get_key(g->window, CRAFT_KEY_ORTHO) ? 64 : 0;
+        g->fov = replay_get_key(g->window, CRAFT_KEY_ZOOM) ? 15 : 65;
+        if (replay_get_key(g->window, CRAFT_KEY_FORWARD)) sz--;
+        if (replay_get_key(g->window, CRAFT_KEY_BACKWARD)) sz++;
+        if (replay_get_key(g->window, CRAFT_KEY_LEFT)) sx--;
+        if (replay_get_key(g->window, CRAFT_KEY_RIGHT)) sx++;
+        if (replay_get_key(g->window, GLFW_KEY_LEFT)) s->rx -= m;
+        if (replay_get_key(g->window, GLFW_KEY_RIGHT)) s->rx += m;
+        if (replay_get_key(g->window, GLFW_KEY_UP)) s->ry += m;
+        if (replay_get_key(g->window, GLFW_KEY_DOWN)) s->ry -= m;
     }
     float vx, vy, vz;
     get_motion_vector(g->flying, sz, sx, s->rx, s->ry, &vx, &vy, &vz);
     if (!g->typing) {
-        if (glfwGetKey(g->window, CRAFT_KEY_JUMP)) {
+        if (replay_get_key(g->window, CRAFT_KEY_JUMP)) {
             if (g->flying) {
                 vy = 1;
             }
@@ -3205,108 +4101,475 @@ void handle_movement(double dt) {
     }
 }
 
-void parse_buffer(char *buffer) {
-    Player *me = g->players;
+void receive_block(int p, int q, int x, int y, int z, int w) {
     State *s = &g->players->state;
-    char *key;
-    char *line = tokenize(buffer, "\n", &key);
-    while (line) {
-        int pid;
-        float ux, uy, uz, urx, ury;
-        if (sscanf(line, "U,%d,%f,%f,%f,%f,%f",
-            &pid, &ux, &uy, &uz, &urx, &ury) == 6)
-        {
-            me->id = pid;
-            s->x = ux; s->y = uy; s->z = uz; s->rx = urx; s->ry = ury;
-            force_chunks(me);
-            if (uy == 0) {
-                s->y = highest_block(s->x, s->z) + 2;
-            }
+    _set_block(p, q, x, y, z, w, 0);
+    if (chunked(x) == p && chunked(z) == q) {
+        dirty_neighbors(x, z);
+    }
+    if (player_intersects_block(2, s->x, s->y, s->z, x, y, z)) {
+        s->y = highest_block(s->x, s->z) + 2;
+    }
+}
+
+void receive_position(int pid, float *v) {
+    Player *player = find_player(pid);
+    if (!player && g->player_count < MAX_PLAYERS) {
+        player = g->players + g->player_count;
+        g->player_count++;
+        player->id = pid;
+        player_hash_insert(player);
+        snprintf(player->name, MAX_NAME_LENGTH, "player%d", pid);
+        update_player(player, v[0], v[1], v[2], v[3], v[4], 1); // twice
+    }
+    if (player) {
+        update_player(player, v[0], v[1], v[2], v[3], v[4], 1);
+    }
+}
+
+void receive_time(double elapsed, int day_length) {
+    if (day_length <= 0) {
+        return;
+    }
+    glfwSetTime(fmod(elapsed, day_length));
+    g->day_length = day_length;
+    g->time_changed = 1;
+}
+
+void receive_nick(int pid, const char *name, int length) {
+    if (length == 0) {
+        return;
+    }
+    Player *player = find_player(pid);
+    if (player) {
+        length = MIN(length, MAX_NAME_LENGTH - 1);
+        memcpy(player->name, name, length);
+        player->name[length] = '\0';
+    }
+}
+
+void recv_you(char *args) {
+    int pid;
+    float v[5];
+    if ((args = parse_int(args, &pid)) && parse_floats(args, v, 5)) {
+        set_player_id(g->players, pid);
+        begin_teleport(v[0], v[1], v[2], v[3], v[4]);
+    }
+}
+
+void recv_block(char *args) {
+    int v[6];
+    if (parse_ints(args, v, 6)) {
+        receive_block(v[0], v[1], v[2], v[3], v[4], v[5]);
+    }
+}
+
+void recv_light(char *args) {
+    int v[6];
+    if (parse_ints(args, v, 6)) {
+        set_light(v[0], v[1], v[2], v[3], v[4], v[5]);
+    }
+}
+
+void recv_position(char *args) {
+    int pid;
+    float v[5];
+    if ((args = parse_int(args, &pid)) && parse_floats(args, v, 5)) {
+        receive_position(pid, v);
+    }
+}
+
+void recv_disconnect(char *args) {
+    int pid;
+    if (parse_int(args, &pid)) {
+        delete_player(pid);
+    }
+}
+
+void recv_key(char *args) {
+    int v[3];
+    if (parse_ints(args, v, 3)) {
+        db_set_key(v[0], v[1], v[2]);
+    }
+}
+
+void recv_redraw(char *args) {
+    int v[2];
+    if (parse_ints(args, v, 2)) {
+        Chunk *chunk = find_chunk(v[0], v[1]);
+        if (chunk) {
+            dirty_chunk(chunk);
         }
-        int bp, bq, bx, by, bz, bw;
-        if (sscanf(line, "B,%d,%d,%d,%d,%d,%d",
-            &bp, &bq, &bx, &by, &bz, &bw) == 6)
-        {
-            _set_block(bp, bq, bx, by, bz, bw, 0);
-            if (player_intersects_block(2, s->x, s->y, s->z, bx, by, bz)) {
-                s->y = highest_block(s->x, s->z) + 2;
-            }
+    }
+}
+
+void recv_time(char *args) {
+    double elapsed;
+    int day_length;
+    if ((args = parse_double(args, &elapsed)) &&
+        parse_int(args, &day_length))
+    {
+        receive_time(elapsed, day_length);
+    }
+}
+
+void recv_talk(char *args) {
+    add_message(args);
+}
+
+void recv_nick(char *args) {
+    int pid;
+    if ((args = parse_int(args, &pid))) {
+        receive_nick(pid, args, strcspn(args, " \t\r\n"));
+    }
+}
+
+void recv_sign(char *args) {
+    int v[6];
+    if ((args = parse_ints(args, v, 6))) {
+        char text[MAX_SIGN_LENGTH];
+        snprintf(text, MAX_SIGN_LENGTH, "%s", args);
+        _set_sign(v[0], v[1], v[2], v[3], v[4], v[5], text, 0);
+    }
+}
+
+// The server acknowledges version 2 with a last text line; everything
+// after it arrives as binary packets.
+void recv_version(char *args) {
+    int version;
+    if (parse_int(args, &version) && version == 2) {
+        client_enable_binary();
+    }
+}
+
+typedef void (*LineHandler)(char *args);
+
+// Server messages are a command byte, a comma and the arguments.
+static const LineHandler line_handlers[128] = {
+    ['U'] = recv_you,
+    ['B'] = recv_block,
+    ['L'] = recv_light,
+    ['P'] = recv_position,
+    ['D'] = recv_disconnect,
+    ['K'] = recv_key,
+    ['R'] = recv_redraw,
+    ['E'] = recv_time,
+    ['T'] = recv_talk,
+    ['N'] = recv_nick,
+    ['S'] = recv_sign,
+    ['V'] = recv_version,
+};
+
+void parse_line(char *line) {
+    unsigned char command = line[0];
+    if (command < 128 && line_handlers[command] && line[1] == ',') {
+        line_handlers[command](line + 2);
+    }
+}
+
+void unpack_player(Packet *packet, int *pid, float *v) {
+    *pid = packet_uint(packet);
+    for (int i = 0; i < 5; i++) {
+        v[i] = packet_float(packet);
+    }
+}
+
+void unpack_you(Packet *packet) {
+    int pid;
+    float v[5];
+    unpack_player(packet, &pid, v);
+    if (!packet->error) {
+        set_player_id(g->players, pid);
+        begin_teleport(v[0], v[1], v[2], v[3], v[4]);
+    }
+}
+
+// Blocks and lights come in runs for one chunk, with x and z relative to
+// the chunk origin.
+void unpack_blocks(Packet *packet) {
+    int p = packet_int(packet);
+    int q = packet_int(packet);
+    int count = packet_uint(packet);
+    for (int i = 0; i < count; i++) {
+        int x = p * CHUNK_SIZE + packet_int(packet);
+        int y = packet_int(packet);
+        int z = q * CHUNK_SIZE + packet_int(packet);
+        int w = packet_int(packet);
+        if (packet->error) {
+            break;
         }
-        if (sscanf(line, "L,%d,%d,%d,%d,%d,%d",
-            &bp, &bq, &bx, &by, &bz, &bw) == 6)
-        {
-            set_light(bp, bq, bx, by, bz, bw);
+        receive_block(p, q, x, y, z, w);
+    }
+}
+
+void unpack_lights(Packet *packet) {
+    int p = packet_int(packet);
+    int q = packet_int(packet);
+    int count = packet_uint(packet);
+    for (int i = 0; i < count; i++) {
+        int x = p * CHUNK_SIZE + packet_int(packet);
+        int y = packet_int(packet);
+        int z = q * CHUNK_SIZE + packet_int(packet);
+        int w = packet_int(packet);
+        if (packet->error) {
+            break;
         }
-        float px, py, pz, prx, pry;
-        if (sscanf(line, "P,%d,%f,%f,%f,%f,%f",
-            &pid, &px, &py, &pz, &prx, &pry) == 6)
-        {
-            Player *player = find_player(pid);
-            if (!player && g->player_count < MAX_PLAYERS) {
-                player = g->players + g->player_count;
-                g->player_count++;
-                player->id = pid;
-                player->buffer = 0;
-                snprintf(player->name, MAX_NAME_LENGTH, "player%d", pid);
-                update_player(player, px, py, pz, prx, pry, 1); // twice
-            }
-            if (player) {
-                update_player(player, px, py, pz, prx, pry, 1);
+        set_light(p, q, x, y, z, w);
+    }
+}
+
+void unpack_position(Packet *packet) {
+    int pid;
+    float v[5];
+    unpack_player(packet, &pid, v);
+    if (!packet->error) {
+        receive_position(pid, v);
+    }
+}
+
+void unpack_disconnect(Packet *packet) {
+    int pid = packet_uint(packet);
+    if (!packet->error) {
+        delete_player(pid);
+    }
+}
+
+void unpack_key(Packet *packet) {
+    int p = packet_int(packet);
+    int q = packet_int(packet);
+    int key = packet_uint(packet);
+    if (!packet->error) {
+        db_set_key(p, q, key);
+    }
+}
+
+void unpack_redraw(Packet *packet) {
+    int p = packet_int(packet);
+    int q = packet_int(packet);
+    Chunk *chunk = find_chunk(p, q);
+    if (!packet->error && chunk) {
+        dirty_chunk(chunk);
+    }
+}
+
+void unpack_time(Packet *packet) {
+    double elapsed = packet_double(packet);
+    int day_length = packet_uint(packet);
+    if (!packet->error) {
+        receive_time(elapsed, day_length);
+    }
+}
+
+void unpack_talk(Packet *packet) {
+    char text[MAX_TEXT_LENGTH];
+    packet_string(packet, text, MAX_TEXT_LENGTH);
+    if (!packet->error) {
+        add_message(text);
+    }
+}
+
+void unpack_nick(Packet *packet) {
+    char name[MAX_NAME_LENGTH];
+    int pid = packet_uint(packet);
+    int length = packet_string(packet, name, MAX_NAME_LENGTH);
+    if (!packet->error) {
+        receive_nick(pid, name, length);
+    }
+}
+
+void unpack_sign(Packet *packet) {
+    char text[MAX_SIGN_LENGTH];
+    int p = packet_int(packet);
+    int q = packet_int(packet);
+    int x = p * CHUNK_SIZE + packet_int(packet);
+    int y = packet_int(packet);
+    int z = q * CHUNK_SIZE + packet_int(packet);
+    int face = packet_uint(packet);
+    packet_string(packet, text, MAX_SIGN_LENGTH);
+    if (!packet->error) {
+        _set_sign(p, q, x, y, z, face, text, 0);
+    }
+}
+
+void apply_snapshot(Snapshot *snapshot) {
+    int p = snapshot->p;
+    int q = snapshot->q;
+    if (snapshot->error) {
+        // the key is not updated, so the next request asks for it all again
+        fprintf(stderr, "Bad snapshot for chunk %d, %d\n", p, q);
+        return;
+    }
+    State *s = &g->players->state;
+    Chunk *chunk = find_chunk(p, q);
+    for (int i = 0; i < snapshot->block_count; i++) {
+        int *b = snapshot->blocks + i * 4;
+        if (chunk) {
+            map_set(&chunk->map, b[0], b[1], b[2], b[3]);
+        }
+        if (chunked(b[0]) == p && chunked(b[2]) == q) {
+            if (b[3] == 0) {
+                unset_sign(b[0], b[1], b[2]);
+                set_light(p, q, b[0], b[1], b[2], 0);
             }
+            dirty_neighbors(b[0], b[2]);
+        }
+        if (player_intersects_block(2, s->x, s->y, s->z, b[0], b[1], b[2])) {
+            s->y = highest_block(s->x, s->z) + 2;
+        }
+    }
+    for (int i = 0; chunk && i < snapshot->light_count; i++) {
+        int *b = snapshot->lights + i * 4;
+        map_set(&chunk->lights, b[0], b[1], b[2], b[3]);
+    }
+    SignList *signs = &snapshot->signs;
+    for (int i = 0; i < signs->size; i++) {
+        Sign *e = signs->data + i;
+        _set_sign(p, q, e->x, e->y, e->z, e->face, e->text, 0);
+    }
+    db_insert_blocks(p, q, snapshot->blocks, snapshot->block_count);
+    db_insert_lights(p, q, snapshot->lights, snapshot->light_count);
+    snapshot->blocks = 0;
+    snapshot->lights = 0;
+    db_set_key(p, q, snapshot->key);
+    if (chunk) {
+        dirty_chunk(chunk);
+    }
+}
+
+// Applies decoded snapshots in order until one is still being decoded or
+// the frame's parse budget, counted from start, is used up. Returns 0 if
+// the budget ran out.
+int apply_snapshots(double start) {
+    int count = 0;
+    int result = 1;
+    while (count < g->snapshot_count &&
+        g->snapshots[count]->state == SNAPSHOT_DONE)
+    {
+        if (count && (glfwGetTime() - start) * 1000 >= PARSE_BUDGET_MS) {
+            result = 0;
+            break;
         }
-        if (sscanf(line, "D,%d", &pid) == 1) {
-            delete_player(pid);
+        trace_begin("apply_snapshot");
+        apply_snapshot(g->snapshots[count]);
+        trace_end("apply_snapshot");
+        snapshot_free(g->snapshots[count]);
+        count++;
+    }
+    if (count) {
+        g->snapshot_count -= count;
+        memmove(g->snapshots, g->snapshots + count,
+            sizeof(Snapshot *) * g->snapshot_count);
+    }
+    return result;
+}
+
+// Snapshots still being decoded are freed by check_workers when their
+// worker is done with them.
+void delete_all_snapshots() {
+    for (int i = 0; i < g->snapshot_count; i++) {
+        Snapshot *snapshot = g->snapshots[i];
+        if (snapshot->state == SNAPSHOT_BUSY) {
+            snapshot->state = SNAPSHOT_DROPPED;
         }
-        int kp, kq, kk;
-        if (sscanf(line, "K,%d,%d,%d", &kp, &kq, &kk) == 3) {
-            db_set_key(kp, kq, kk);
+        else {
+            snapshot_free(snapshot);
         }
-        if (sscanf(line, "R,%d,%d", &kp, &kq) == 2) {
-            Chunk *chunk = find_chunk(kp, kq);
-            if (chunk) {
-                dirty_chunk(chunk);
+    }
+    g->snapshot_count = 0;
+}
+
+// A whole chunk in one zlib stream, decoded on a worker.
+void unpack_snapshot(Packet *packet) {
+    int p = packet_int(packet);
+    int q = packet_int(packet);
+    int key = packet_uint(packet);
+    int size = packet_uint(packet);
+    if (packet->error || g->snapshot_count == MAX_SNAPSHOTS) {
+        return;
+    }
+    Snapshot *snapshot = snapshot_create(p, q, key, size,
+        (const char *)packet->data + packet->offset,
+        packet->size - packet->offset);
+    g->snapshots[g->snapshot_count++] = snapshot;
+}
+
+typedef void (*PacketHandler)(Packet *packet);
+
+// Binary packets use the same command bytes as the text protocol.
+static const PacketHandler packet_handlers[128] = {
+    ['U'] = unpack_you,
+    ['B'] = unpack_blocks,
+    ['L'] = unpack_lights,
+    ['P'] = unpack_position,
+    ['D'] = unpack_disconnect,
+    ['K'] = unpack_key,
+    ['R'] = unpack_redraw,
+    ['E'] = unpack_time,
+    ['T'] = unpack_talk,
+    ['N'] = unpack_nick,
+    ['S'] = unpack_sign,
+    ['Z'] = unpack_snapshot,
+};
+
+void parse_packet(char *data, int length) {
+    unsigned char command = data[0];
+    if (command < 128 && packet_handlers[command]) {
+        Packet packet;
+        packet_init(&packet, data + 1, length - 1);
+        packet_handlers[command](&packet);
+    }
+}
+
+// Handles the messages that have arrived from the server, parsed in place
+// in the receive ring, after the snapshots decoded since the last frame.
+// Whatever is left after the time budget waits for the next frame.
+void parse_lines() {
+    double start = glfwGetTime();
+    int count = 0;
+    if (!apply_snapshots(start)) {
+        return;
+    }
+    while (1) {
+        if (get_client_binary()) {
+            int length;
+            char *data = client_recv_packet(&length);
+            if (!data) {
+                break;
+            }
+            if (g->snapshot_count &&
+                (data[0] != 'Z' || g->snapshot_count == MAX_SNAPSHOTS))
+            {
+                // wait until the snapshots ahead of it have been applied
+                client_unread();
+                break;
+            }
+            parse_packet(data, length);
+        }
+        else {
+            char *line = client_recv_line();
+            if (!line) {
+                break;
             }
+            parse_line(line);
         }
-        double elapsed;
-        int day_length;
-        if (sscanf(line, "E,%lf,%d", &elapsed, &day_length) == 2) {
-            glfwSetTime(fmod(elapsed, day_length));
-            g->day_length = day_length;
-            g->time_changed = 1;
-        }
-        if (line[0] == 'T' && line[1] == ',') {
-            char *text = line + 2;
-            add_message(text);
-        }
-        char format[64];
-        snprintf(
-            format, sizeof(format), "N,%%d,%%%ds", MAX_NAME_LENGTH - 1);
-        char name[MAX_NAME_LENGTH];
-        if (sscanf(line, format, &pid, name) == 2) {
-            Player *player = find_player(pid);
-            if (player) {
-                strncpy(player->name, name, MAX_NAME_LENGTH);
-            }
-        }
-        snprintf(
-            format, sizeof(format),
-            "S,%%d,%%d,%%d,%%d,%%d,%%d,%%%d[^\n]", MAX_SIGN_LENGTH - 1);
-        int face;
-        char text[MAX_SIGN_LENGTH] = {0};
-        if (sscanf(line, format,
-            &bp, &bq, &bx, &by, &bz, &face, text) >= 6)
+        // reading the clock costs more than most messages
+        if (++count % 64 == 0 &&
+            (glfwGetTime() - start) * 1000 >= PARSE_BUDGET_MS)
         {
-            _set_sign(bp, bq, bx, by, bz, face, text, 0);
+            break;
         }
-        line = tokenize(NULL, "\n", &key);
     }
 }
 
 void reset_model() {
+    g->view = &g->visibility;
     memset(g->chunks, 0, sizeof(Chunk) * MAX_CHUNKS);
     g->chunk_count = 0;
+    memset(g->chunk_hash, 0, sizeof(g->chunk_hash));
+    g->ready_count = 0;
     memset(g->players, 0, sizeof(Player) * MAX_PLAYERS);
     g->player_count = 0;
+    memset(g->player_hash, 0, sizeof(g->player_hash));
     g->observe1 = 0;
     g->observe2 = 0;
     g->flying = 0;
@@ -3315,6 +4578,9 @@ void reset_model() {
     g->typing = 0;
     memset(g->messages, 0, sizeof(char) * MAX_MESSAGES * MAX_TEXT_LENGTH);
     g->message_index = 0;
+    memset(&g->teleport, 0, sizeof(Teleport));
+    g->velocity_x = 0;
+    g->velocity_z = 0;
     g->day_length = DAY_LENGTH;
     glfwSetTime(g->day_length / 3.0);
     g->time_changed = 1;
@@ -3323,7 +4589,34 @@ void reset_model() {
 int main(int argc, char **argv) {
     // INITIALIZATION //
     curl_global_init(CURL_GLOBAL_DEFAULT);
-    srand(time(NULL));
+    unsigned int seed = time(NULL);
+    const char *timings_path = 0;
+    int args = 1;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--record") == 0) {
+            if (!replay_record(argv[++i], seed)) {
+                fprintf(stderr, "Could not write %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--replay") == 0) {
+            if (!replay_play(argv[++i], &seed)) {
+                fprintf(stderr, "Could not read %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--timings") == 0) {
+            timings_path = argv[++i];
+        }
+        else {
+            argv[args++] = argv[i];
+        }
+    }
+    argc = args;
+    if (replay_mode() == REPLAY_PLAY && !timings_path) {
+        timings_path = "craft-timings.csv";
+    }
+    srand(seed);
     rand();
 
     // Initialize voxel text system
@@ -3349,8 +4642,16 @@ int main(int argc, char **argv) {
         return -1;
     }
 
+    if (replay_mode() != REPLAY_OFF) {
+        int width, height;
+        glfwGetWindowSize(g->window, &width, &height);
+        replay_window(&width, &height);
+        glfwSetWindowSize(g->window, width, height);
+    }
+
     glfwMakeContextCurrent(g->window);
-    glfwSwapInterval(VSYNC);
+    // playback runs as fast as it can, the recorded clock sets the pace
+    glfwSwapInterval(replay_mode() == REPLAY_PLAY ? 0 : VSYNC);
     glfwSetInputMode(g->window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetKeyCallback(g->window, on_key);
     glfwSetCharCallback(g->window, on_char);
@@ -3361,6 +4662,13 @@ int main(int argc, char **argv) {
         return -1;
     }
 
+    profile_init();
+    if (timings_path && !profile_log(timings_path)) {
+        fprintf(stderr, "Could not write %s\n", timings_path);
+    }
+    trace_init();
+    trace_thread("main");
+
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
     glLogicOp(GL_INVERT);
@@ -3422,6 +4730,11 @@ int main(int argc, char **argv) {
     block_attrib.extra4 = glGetUniformLocation(program, "ortho");
     block_attrib.camera = glGetUniformLocation(program, "camera");
     block_attrib.timer = glGetUniformLocation(program, "timer");
+    block_attrib.model = glGetUniformLocation(program, "model");
+    float identity[16];
+    mat_identity(identity);
+    glUseProgram(program);
+    glUniformMatrix4fv(block_attrib.model, 1, GL_FALSE, identity);
 
     program = load_program(
         "shaders/line_vertex.glsl", "shaders/line_fragment.glsl");
@@ -3471,6 +4784,8 @@ int main(int argc, char **argv) {
         Worker *worker = g->workers + i;
         worker->index = i;
         worker->state = WORKER_IDLE;
+        worker->exit = 0;
+        worker->snapshot = 0;
         mtx_init(&worker->mtx, mtx_plain);
         cnd_init(&worker->cnd);
         thrd_create(&worker->thrd, worker_run, worker);
@@ -3489,6 +4804,7 @@ int main(int argc, char **argv) {
                 // TODO: support proper caching of signs (handle deletions)
                 db_delete_all_signs();
             }
+            bible_load_positions();
         }
 
         // CLIENT INITIALIZATION //
@@ -3506,6 +4822,13 @@ int main(int argc, char **argv) {
             }
             else {
                 client_version(1);
+                if (BINARY_PROTOCOL) {
+                    // servers that only speak text ignore a second version
+                    client_version(2);
+                }
+                // chunk edges are meshed from the neighbouring chunks, so
+                // the server can leave out its padding copies
+                client_version(3);
                 login();
             }
         }
@@ -3513,20 +4836,26 @@ int main(int argc, char **argv) {
         // LOCAL VARIABLES //
         reset_model();
         FPS fps = {0, 0, 0};
-        double last_commit = glfwGetTime();
-        double last_update = glfwGetTime();
+        double last_commit = replay_time();
+        double last_update = replay_time();
         GLuint sky_buffer = gen_sky_buffer();
+        g->player_buffer = gen_player_buffer();
+        stream_alloc(&g->stream, STREAM_SIZE);
 
         Player *me = g->players;
         State *s = &g->players->state;
         me->id = 0;
         me->name[0] = '\0';
-        me->buffer = 0;
         g->player_count = 1;
+        player_hash_insert(me);
 
         // LOAD STATE FROM DATABASE //
         int loaded = db_load_state(&s->x, &s->y, &s->z, &s->rx, &s->ry);
         force_chunks(me);
+        if (loaded && s->y == 0) {
+            // saved during a teleport that had no height yet
+            s->y = highest_block(s->x, s->z) + 2;
+        }
         if (!loaded) {
             // New game - spawn directly on platform
             s->x = BIBLE_SPAWN_X;
@@ -3535,6 +4864,7 @@ int main(int argc, char **argv) {
             s->rx = 0;   // Look forward (along Z axis)
             s->ry = -20; // Look down to see help message
         }
+        replay_state(&s->x, &s->y, &s->z, &s->rx, &s->ry);
 
         // GENERATE BIBLE IN WORLD (IF ENABLED) //
 #if GENERATE_BIBLE
@@ -3588,8 +4918,15 @@ int main(int argc, char **argv) {
 #endif
 
         // BEGIN MAIN LOOP //
-        double previous = glfwGetTime();
+        double previous = replay_time();
         while (1) {
+            if (!replay_frame()) {
+                running = 0;
+                break;
+            }
+            profile_begin(PHASE_FRAME);
+            trace_begin("frame");
+
             // WINDOW SIZE AND SCALE //
             g->scale = get_scale_factor();
             glfwGetFramebufferSize(g->window, &g->width, &g->height);
@@ -3598,12 +4935,12 @@ int main(int argc, char **argv) {
             // FRAME RATE //
             if (g->time_changed) {
                 g->time_changed = 0;
-                last_commit = glfwGetTime();
-                last_update = glfwGetTime();
+                last_commit = replay_time();
+                last_update = replay_time();
                 memset(&fps, 0, sizeof(fps));
             }
             update_fps(&fps);
-            double now = glfwGetTime();
+            double now = replay_time();
             double dt = now - previous;
             dt = MIN(dt, 0.2);
             dt = MAX(dt, 0.0);
@@ -3613,14 +4950,17 @@ int main(int argc, char **argv) {
             handle_mouse_input();
 
             // HANDLE MOVEMENT //
+            profile_begin(PHASE_MOVEMENT);
             handle_movement(dt);
+            update_velocity(dt);
+            profile_end(PHASE_MOVEMENT);
 
             // HANDLE DATA FROM SERVER //
-            char *buffer = client_recv();
-            if (buffer) {
-                parse_buffer(buffer);
-                free(buffer);
-            }
+            profile_begin(PHASE_NETWORK);
+            trace_begin("parse_lines");
+            parse_lines();
+            trace_end("parse_lines");
+            profile_end(PHASE_NETWORK);
 
             // FLUSH DATABASE //
             if (now - last_commit > COMMIT_INTERVAL) {
@@ -3629,32 +4969,49 @@ int main(int argc, char **argv) {
             }
 
             // UPDATE PROGRESSIVE BUILDER //
+            profile_begin(PHASE_BUILDER);
             progressive_builder_update();
+            profile_end(PHASE_BUILDER);
+
+            // FINISH PENDING TELEPORT //
+            update_teleport();
 
             // SEND POSITION TO SERVER //
             if (now - last_update > 0.1) {
+                // while a teleport waits for its chunks the server already
+                // has the player at the destination
+                State *r = g->teleport.active ? &g->teleport.state : s;
                 last_update = now;
-                client_position(s->x, s->y, s->z, s->rx, s->ry);
+                client_position(r->x, r->y, r->z, r->rx, r->ry);
             }
 
             // PREPARE TO RENDER //
             g->observe1 = g->observe1 % g->player_count;
             g->observe2 = g->observe2 % g->player_count;
+            profile_begin(PHASE_DELETE);
             delete_chunks();
-            del_buffer(me->buffer);
-            me->buffer = gen_player_buffer(s->x, s->y, s->z, s->rx, s->ry);
+            profile_end(PHASE_DELETE);
+            profile_begin(PHASE_UPLOAD);
+            trace_begin("upload_chunks");
+            upload_chunks();
+            trace_end("upload_chunks");
+            profile_end(PHASE_UPLOAD);
             for (int i = 1; i < g->player_count; i++) {
                 interpolate_player(g->players + i);
             }
             Player *player = g->players + g->observe1;
 
             // RENDER 3-D SCENE //
+            profile_gpu_begin();
             glClear(GL_COLOR_BUFFER_BIT);
             glClear(GL_DEPTH_BUFFER_BIT);
             render_sky(&sky_attrib, player, sky_buffer);
             glClear(GL_DEPTH_BUFFER_BIT);
             int face_count = render_chunks(&block_attrib, player);
-            render_signs(&text_attrib, player);
+            render_occlusion_queries(&line_attrib);
+            profile_begin(PHASE_SIGNS);
+            render_signs(&text_attrib);
+            profile_end(PHASE_SIGNS);
             render_sign(&text_attrib, player);
             render_players(&block_attrib, player);
             if (SHOW_WIREFRAME) {
@@ -3662,6 +5019,7 @@ int main(int argc, char **argv) {
             }
 
             // RENDER HUD //
+            profile_begin(PHASE_HUD);
             glClear(GL_DEPTH_BUFFER_BIT);
             if (SHOW_CROSSHAIRS) {
                 render_crosshairs(&line_attrib);
@@ -3686,24 +5044,29 @@ int main(int argc, char **argv) {
                     chunked(s->x), chunked(s->z), s->x, s->y, s->z,
                     g->player_count, g->chunk_count,
                     face_count * 2, hour, am_pm, fps.fps);
-                render_text(&text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                render_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
                 ty -= ts * 2;
             }
             if (SHOW_CHAT_TEXT) {
                 for (int i = 0; i < MAX_MESSAGES; i++) {
                     int index = (g->message_index + i) % MAX_MESSAGES;
                     if (strlen(g->messages[index])) {
-                        render_text(&text_attrib, ALIGN_LEFT, tx, ty, ts,
+                        render_text(ALIGN_LEFT, tx, ty, ts,
                             g->messages[index]);
                         ty -= ts * 2;
                     }
                 }
             }
+            if (g->teleport.active) {
+                render_text(ALIGN_LEFT, tx, ty, ts,
+                    "Loading destination...");
+                ty -= ts * 2;
+            }
             // Show progressive builder progress
             if (progressive_builder_is_active()) {
                 int remaining = progressive_builder_get_queue_size();
                 snprintf(text_buffer, 1024, "Building: %d blocks remaining...", remaining);
-                render_text(&text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                render_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
                 ty -= ts * 2;
             }
             if (g->typing) {
@@ -3715,21 +5078,32 @@ int main(int argc, char **argv) {
                 strcpy(temp_buffer + g->typing_cursor + 1,
                        g->typing_buffer + g->typing_cursor);
                 snprintf(text_buffer, 1024, "> %s", temp_buffer);
-                render_text(&text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                render_text(ALIGN_LEFT, tx, ty, ts, text_buffer);
                 ty -= ts * 2;
             }
             if (SHOW_PLAYER_NAMES) {
                 if (player != me) {
-                    render_text(&text_attrib, ALIGN_CENTER,
+                    render_text(ALIGN_CENTER,
                         g->width / 2, ts, ts, player->name);
                 }
                 Player *other = player_crosshair(player);
                 if (other) {
-                    render_text(&text_attrib, ALIGN_CENTER,
+                    render_text(ALIGN_CENTER,
                         g->width / 2, g->height / 2 - ts - 24, ts,
                         other->name);
                 }
             }
+            if (g->show_stats) {
+                float sy = g->height - ts;
+                for (int i = 0; i < profile_lines(); i++) {
+                    profile_line(i, text_buffer, 1024);
+                    render_text(ALIGN_RIGHT, g->width - ts, sy, ts,
+                        text_buffer);
+                    sy -= ts * 2;
+                }
+            }
+            flush_text(&text_attrib);
+            profile_end(PHASE_HUD);
 
             // RENDER PICTURE IN PICTURE //
             if (g->observe2) {
@@ -3756,19 +5130,34 @@ int main(int argc, char **argv) {
 
                 render_sky(&sky_attrib, player, sky_buffer);
                 glClear(GL_DEPTH_BUFFER_BIT);
+                g->view = &g->inset_visibility;
                 render_chunks(&block_attrib, player);
-                render_signs(&text_attrib, player);
+                render_signs(&text_attrib);
+                g->view = &g->visibility;
                 render_players(&block_attrib, player);
                 glClear(GL_DEPTH_BUFFER_BIT);
                 if (SHOW_PLAYER_NAMES) {
-                    render_text(&text_attrib, ALIGN_CENTER,
+                    render_text(ALIGN_CENTER,
                         pw / 2, ts, ts, player->name);
+                    flush_text(&text_attrib);
                 }
             }
 
             // SWAP AND POLL //
+            profile_gpu_end();
+            profile_begin(PHASE_SWAP);
+            trace_begin("swap");
             glfwSwapBuffers(g->window);
             glfwPollEvents();
+            replay_events();
+            trace_end("swap");
+            profile_end(PHASE_SWAP);
+            profile_set(COUNTER_CHUNKS, g->chunk_count);
+            profile_set(COUNTER_MESH_BYTES, mesh_bytes() / 1048576.0);
+            profile_set(COUNTER_DB_QUEUE, db_queue_size());
+            profile_end(PHASE_FRAME);
+            profile_frame();
+            trace_end("frame");
             if (glfwWindowShouldClose(g->window)) {
                 running = 0;
                 break;
@@ -3780,18 +5169,28 @@ int main(int argc, char **argv) {
         }
 
         // SHUTDOWN //
-        db_save_state(s->x, s->y, s->z, s->rx, s->ry);
+        State *saved = g->teleport.active ? &g->teleport.state : s;
+        db_save_state(
+            saved->x, saved->y, saved->z, saved->rx, saved->ry);
         db_close();
         db_disable();
         client_stop();
         client_disable();
         del_buffer(sky_buffer);
+        del_buffer(g->player_buffer);
+        stream_free(&g->stream);
+        delete_all_snapshots();
         delete_all_chunks();
         delete_all_players();
     }
 
     // Cleanup systems
+    stop_workers();
     progressive_builder_cleanup();
+    profile_free();
+    trace_free();
+    replay_close();
+    free(g->text_data);
 
     glfwTerminate();
     curl_global_cleanup();
@@ -0,0 +1,78 @@
+#include <string.h>
+#include "packet.h"
+
+// Reads the fields of a binary message. Integers are LEB128 varints,
+// signed ones zigzag encoded, and floats are little-endian IEEE 754.
+// Reading past the end sets error and returns zeros, so a handler can
+// read all of its fields and check once.
+
+void packet_init(Packet *packet, const char *data, int size) {
+    packet->data = (const unsigned char *)data;
+    packet->size = size;
+    packet->offset = 0;
+    packet->error = 0;
+}
+
+unsigned int packet_uint(Packet *packet) {
+    unsigned int result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (packet->offset >= packet->size) {
+            break;
+        }
+        unsigned char c = packet->data[packet->offset++];
+        result |= (unsigned int)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return result;
+        }
+    }
+    packet->error = 1;
+    return 0;
+}
+
+int packet_int(Packet *packet) {
+    unsigned int n = packet_uint(packet);
+    return (int)(n >> 1) ^ -(int)(n & 1);
+}
+
+static unsigned long long packet_bytes(Packet *packet, int count) {
+    if (packet->size - packet->offset < count) {
+        packet->offset = packet->size;
+        packet->error = 1;
+        return 0;
+    }
+    unsigned long long result = 0;
+    for (int i = 0; i < count; i++) {
+        result |= (unsigned long long)packet->data[packet->offset++] << (i * 8);
+    }
+    return result;
+}
+
+float packet_float(Packet *packet) {
+    unsigned int bits = packet_bytes(packet, 4);
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+double packet_double(Packet *packet) {
+    unsigned long long bits = packet_bytes(packet, 8);
+    double result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// Copies a length-prefixed string into buffer, truncated to fit and
+// null-terminated. Returns the number of bytes copied.
+int packet_string(Packet *packet, char *buffer, int size) {
+    unsigned int length = packet_uint(packet);
+    if (length > (unsigned int)(packet->size - packet->offset)) {
+        packet->offset = packet->size;
+        packet->error = 1;
+        length = 0;
+    }
+    int count = length < (unsigned int)size - 1 ? (int)length : size - 1;
+    memcpy(buffer, packet->data + packet->offset, count);
+    buffer[count] = '\0';
+    packet->offset += length;
+    return count;
+}
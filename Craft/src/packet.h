@@ -0,0 +1,18 @@
+#ifndef _packet_h_
+#define _packet_h_
+
+typedef struct {
+    const unsigned char *data;
+    int size;
+    int offset;
+    int error;
+} Packet;
+
+void packet_init(Packet *packet, const char *data, int size);
+unsigned int packet_uint(Packet *packet);
+int packet_int(Packet *packet);
+float packet_float(Packet *packet);
+double packet_double(Packet *packet);
+int packet_string(Packet *packet, char *buffer, int size);
+
+#endif
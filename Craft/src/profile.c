@@ -0,0 +1,227 @@
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+#define GPU_QUERIES 4
+
+typedef struct {
+    double start;
+    double current;
+    double samples[PROFILE_HISTORY];
+} Phase;
+
+typedef struct {
+    double current;
+    double samples[PROFILE_HISTORY];
+} Counter;
+
+static const char *phase_names[PHASE_COUNT] = {
+    "frame", "movement", "network", "builder", "delete", "upload",
+    "ensure", "chunks", "signs", "hud", "swap", "gpu"
+};
+
+static const char *counter_names[COUNTER_COUNT] = {
+    "jobs", "uploads", "upload KB", "chunks", "mesh MB", "db queue"
+};
+
+static Phase phases[PHASE_COUNT];
+static Counter counters[COUNTER_COUNT];
+static int frame = 0;
+static int filled = 0;
+static FILE *log_file = 0;
+static int log_frame = 0;
+
+// GL timer queries are read back a few frames later so they never stall
+static int gpu_enabled = 0;
+static GLuint gpu_queries[GPU_QUERIES];
+static int gpu_pending[GPU_QUERIES];
+static int gpu_index = 0;
+
+void profile_init() {
+    memset(phases, 0, sizeof(phases));
+    memset(counters, 0, sizeof(counters));
+    frame = 0;
+    filled = 0;
+    gpu_enabled = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (gpu_enabled) {
+        glGenQueries(GPU_QUERIES, gpu_queries);
+        memset(gpu_pending, 0, sizeof(gpu_pending));
+    }
+}
+
+void profile_free() {
+    if (gpu_enabled) {
+        glDeleteQueries(GPU_QUERIES, gpu_queries);
+        gpu_enabled = 0;
+    }
+    if (log_file) {
+        fclose(log_file);
+        log_file = 0;
+    }
+}
+
+// Writes every frame's phase times (ms) and counters to a CSV file.
+int profile_log(const char *path) {
+    log_file = fopen(path, "w");
+    if (!log_file) {
+        return 0;
+    }
+    log_frame = 0;
+    fprintf(log_file, "frame");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(log_file, ",%s ms", phase_names[i]);
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        fprintf(log_file, ",%s", counter_names[i]);
+    }
+    fprintf(log_file, "\n");
+    return 1;
+}
+
+static void profile_log_frame() {
+    fprintf(log_file, "%d", log_frame++);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(log_file, ",%.3f", phases[i].current * 1000);
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        fprintf(log_file, ",%g", counters[i].current);
+    }
+    fprintf(log_file, "\n");
+}
+
+void profile_begin(int phase) {
+    phases[phase].start = glfwGetTime();
+}
+
+// phases may run several times per frame; their times add up
+void profile_end(int phase) {
+    Phase *p = phases + phase;
+    p->current += glfwGetTime() - p->start;
+}
+
+void profile_gpu_begin() {
+    if (!gpu_enabled || gpu_pending[gpu_index]) {
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, gpu_queries[gpu_index]);
+}
+
+void profile_gpu_end() {
+    if (!gpu_enabled || gpu_pending[gpu_index]) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    gpu_pending[gpu_index] = 1;
+    gpu_index = (gpu_index + 1) % GPU_QUERIES;
+}
+
+static void profile_gpu_collect() {
+    for (int i = 0; i < GPU_QUERIES; i++) {
+        if (!gpu_pending[i]) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(
+            gpu_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(gpu_queries[i], GL_QUERY_RESULT, &elapsed);
+            phases[PHASE_GPU].current = elapsed / 1e9;
+            gpu_pending[i] = 0;
+        }
+    }
+}
+
+void profile_count(int counter, double value) {
+    counters[counter].current += value;
+}
+
+void profile_set(int counter, double value) {
+    counters[counter].current = value;
+}
+
+// Closes the frame: current values go into the history and are reset.
+void profile_frame() {
+    if (gpu_enabled) {
+        profile_gpu_collect();
+    }
+    if (log_file) {
+        profile_log_frame();
+    }
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        Phase *p = phases + i;
+        p->samples[frame] = p->current;
+        // the GPU time stays until a newer result arrives
+        if (i != PHASE_GPU) {
+            p->current = 0;
+        }
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        Counter *c = counters + i;
+        c->samples[frame] = c->current;
+        c->current = 0;
+    }
+    frame = (frame + 1) % PROFILE_HISTORY;
+    if (filled < PROFILE_HISTORY) {
+        filled++;
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void summarize(
+    const double *samples, double *average, double *p99, double *maximum)
+{
+    double sorted[PROFILE_HISTORY];
+    int n = filled;
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        sorted[i] = samples[i];
+        total += samples[i];
+    }
+    *average = *p99 = *maximum = 0;
+    if (!n) {
+        return;
+    }
+    qsort(sorted, n, sizeof(double), compare_double);
+    *average = total / n;
+    *p99 = sorted[(n * 99) / 100];
+    *maximum = sorted[n - 1];
+}
+
+int profile_lines() {
+    return 1 + PHASE_COUNT + COUNTER_COUNT;
+}
+
+void profile_line(int index, char *buffer, int length) {
+    double average, p99, maximum;
+    if (index == 0) {
+        snprintf(buffer, length, "%-10s %8s %8s %8s (%d frames)",
+            "", "avg", "p99", "max", filled);
+        return;
+    }
+    index--;
+    if (index < PHASE_COUNT) {
+        if (index == PHASE_GPU && !gpu_enabled) {
+            snprintf(buffer, length, "%-10s n/a", phase_names[index]);
+            return;
+        }
+        summarize(phases[index].samples, &average, &p99, &maximum);
+        snprintf(buffer, length, "%-10s %6.2fms %6.2fms %6.2fms",
+            phase_names[index], average * 1000, p99 * 1000, maximum * 1000);
+        return;
+    }
+    index -= PHASE_COUNT;
+    if (index < COUNTER_COUNT) {
+        summarize(counters[index].samples, &average, &p99, &maximum);
+        snprintf(buffer, length, "%-10s %8.1f %8.1f %8.1f",
+            counter_names[index], average, p99, maximum);
+    }
+}
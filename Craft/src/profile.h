@@ -0,0 +1,45 @@
+#ifndef _profile_h_
+#define _profile_h_
+
+#define PROFILE_HISTORY 256
+
+enum {
+    PHASE_FRAME,
+    PHASE_MOVEMENT,
+    PHASE_NETWORK,
+    PHASE_BUILDER,
+    PHASE_DELETE,
+    PHASE_UPLOAD,
+    PHASE_ENSURE,
+    PHASE_CHUNKS,
+    PHASE_SIGNS,
+    PHASE_HUD,
+    PHASE_SWAP,
+    PHASE_GPU,
+    PHASE_COUNT
+};
+
+enum {
+    COUNTER_JOBS,
+    COUNTER_UPLOADS,
+    COUNTER_UPLOAD_BYTES,
+    COUNTER_CHUNKS,
+    COUNTER_MESH_BYTES,
+    COUNTER_DB_QUEUE,
+    COUNTER_COUNT
+};
+
+void profile_init();
+void profile_free();
+int profile_log(const char *path);
+void profile_begin(int phase);
+void profile_end(int phase);
+void profile_gpu_begin();
+void profile_gpu_end();
+void profile_count(int counter, double value);
+void profile_set(int counter, double value);
+void profile_frame();
+int profile_lines();
+void profile_line(int index, char *buffer, int length);
+
+#endif
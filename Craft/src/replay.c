@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+#define MAX_LINE 1024
+#define MAX_KEYS 32
+#define MAX_EVENTS 256
+
+// A recording is a text file with one input per line. Each frame starts
+// with F and the frame clock; the lines after it are the key and cursor
+// state polled that frame followed by the callback events delivered by
+// glfwPollEvents at its end. Playback buffers a whole frame at a time.
+
+typedef struct {
+    int key;
+    int state;
+} KeyState;
+
+static int mode = REPLAY_OFF;
+static FILE *file = 0;
+static double frame_time = 0;
+static char line[MAX_LINE];
+static int has_line = 0;
+
+static KeyState keys[MAX_KEYS];
+static int key_count = 0;
+static double cursor_x = 0;
+static double cursor_y = 0;
+static int exclusive = GLFW_CURSOR_DISABLED;
+static ReplayEvent events[MAX_EVENTS];
+static int event_count = 0;
+static int event_index = 0;
+static int dispatching = 0;
+static char clipboard[MAX_LINE];
+
+static int window_width = 0;
+static int window_height = 0;
+static int has_state = 0;
+static float state[5];
+
+static void write_escaped(const char *text) {
+    for (const char *c = text; *c; c++) {
+        if (*c == '\\') {
+            fputs("\\\\", file);
+        }
+        else if (*c == '\n') {
+            fputs("\\n", file);
+        }
+        else if (*c == '\r') {
+            fputs("\\r", file);
+        }
+        else {
+            fputc(*c, file);
+        }
+    }
+}
+
+static void read_escaped(char *dst, const char *src, int length) {
+    int n = 0;
+    while (*src && n < length - 1) {
+        char c = *src++;
+        if (c == '\\' && *src) {
+            c = *src++;
+            c = c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+        }
+        dst[n++] = c;
+    }
+    dst[n] = '\0';
+}
+
+static int read_line() {
+    has_line = fgets(line, MAX_LINE, file) != 0;
+    if (has_line) {
+        line[strcspn(line, "\r\n")] = '\0';
+    }
+    return has_line;
+}
+
+int replay_record(const char *path, unsigned int seed) {
+    replay_close();
+    file = fopen(path, "w");
+    if (!file) {
+        return 0;
+    }
+    mode = REPLAY_RECORD;
+    has_state = 0;
+    fprintf(file, "# craft replay\nR,%u\n", seed);
+    return 1;
+}
+
+// Reads the header up to the first frame. The seed, window size and
+// starting state are applied by the caller.
+int replay_play(const char *path, unsigned int *seed) {
+    replay_close();
+    file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    mode = REPLAY_PLAY;
+    has_state = 0;
+    window_width = window_height = 0;
+    while (read_line() && line[0] != 'F') {
+        if (sscanf(line, "R,%u", seed) == 1) {
+            continue;
+        }
+        if (sscanf(line, "W,%d,%d", &window_width, &window_height) == 2) {
+            continue;
+        }
+        if (sscanf(line, "P,%f,%f,%f,%f,%f",
+            state, state + 1, state + 2, state + 3, state + 4) == 5)
+        {
+            has_state = 1;
+        }
+    }
+    return 1;
+}
+
+void replay_close() {
+    if (file) {
+        fclose(file);
+        file = 0;
+    }
+    mode = REPLAY_OFF;
+    has_line = 0;
+    key_count = 0;
+    event_count = 0;
+    event_index = 0;
+    dispatching = 0;
+}
+
+int replay_mode() {
+    return mode;
+}
+
+void replay_window(int *width, int *height) {
+    if (mode == REPLAY_RECORD) {
+        fprintf(file, "W,%d,%d\n", *width, *height);
+    }
+    if (mode == REPLAY_PLAY && window_width && window_height) {
+        *width = window_width;
+        *height = window_height;
+    }
+}
+
+// The starting position is recorded once and applied once, so a later
+// switch between online and offline does not move the player back.
+void replay_state(float *x, float *y, float *z, float *rx, float *ry) {
+    if (mode == REPLAY_RECORD && !has_state) {
+        fprintf(file, "P,%.9g,%.9g,%.9g,%.9g,%.9g\n", *x, *y, *z, *rx, *ry);
+        has_state = 1;
+    }
+    if (mode == REPLAY_PLAY && has_state) {
+        *x = state[0]; *y = state[1]; *z = state[2];
+        *rx = state[3]; *ry = state[4];
+        has_state = 0;
+    }
+}
+
+static void parse_frame_line() {
+    int key, value;
+    if (sscanf(line, "K,%d,%d", &key, &value) == 2) {
+        if (key_count < MAX_KEYS) {
+            keys[key_count].key = key;
+            keys[key_count].state = value;
+            key_count++;
+        }
+        return;
+    }
+    if (sscanf(line, "C,%lf,%lf", &cursor_x, &cursor_y) == 2) {
+        return;
+    }
+    if (sscanf(line, "X,%d", &exclusive) == 1) {
+        return;
+    }
+    if (line[0] == 'V' && line[1] == ',') {
+        read_escaped(clipboard, line + 2, MAX_LINE);
+        return;
+    }
+    if (event_count == MAX_EVENTS) {
+        return;
+    }
+    ReplayEvent *e = events + event_count;
+    memset(e, 0, sizeof(ReplayEvent));
+    if (sscanf(line, "k,%d,%d,%d,%d", &e->a, &e->b, &e->c, &e->d) == 4) {
+        e->type = REPLAY_KEY;
+    }
+    else if (sscanf(line, "c,%d", &e->a) == 1) {
+        e->type = REPLAY_CHAR;
+    }
+    else if (sscanf(line, "b,%d,%d,%d", &e->a, &e->b, &e->c) == 3) {
+        e->type = REPLAY_BUTTON;
+    }
+    else if (sscanf(line, "s,%lf,%lf", &e->x, &e->y) == 2) {
+        e->type = REPLAY_SCROLL;
+    }
+    else {
+        return;
+    }
+    event_count++;
+}
+
+// Starts a frame. Returns 0 once a playback has run out of frames.
+int replay_frame() {
+    key_count = 0;
+    if (mode == REPLAY_PLAY) {
+        event_count = 0;
+        event_index = 0;
+        if (!has_line || sscanf(line, "F,%lf", &frame_time) != 1) {
+            return 0;
+        }
+        while (read_line() && line[0] != 'F') {
+            parse_frame_line();
+        }
+        return 1;
+    }
+    frame_time = glfwGetTime();
+    if (mode == REPLAY_RECORD) {
+        fprintf(file, "F,%.17g\n", frame_time);
+    }
+    return 1;
+}
+
+// The frame clock while recording or playing back, so everything that
+// runs off the time (movement, day length, interpolation) sees the
+// same values on every run.
+double replay_time() {
+    if (mode == REPLAY_OFF) {
+        return glfwGetTime();
+    }
+    return frame_time;
+}
+
+int replay_get_key(GLFWwindow *window, int key) {
+    if (mode == REPLAY_PLAY) {
+        for (int i = 0; i < key_count; i++) {
+            if (keys[i].key == key) {
+                return keys[i].state;
+            }
+        }
+        return GLFW_RELEASE;
+    }
+    int result = glfwGetKey(window, key);
+    if (mode == REPLAY_RECORD) {
+        for (int i = 0; i < key_count; i++) {
+            if (keys[i].key == key) {
+                return result;
+            }
+        }
+        if (key_count < MAX_KEYS) {
+            keys[key_count++].key = key;
+        }
+        fprintf(file, "K,%d,%d\n", key, result);
+    }
+    return result;
+}
+
+void replay_get_cursor(GLFWwindow *window, double *x, double *y) {
+    if (mode == REPLAY_PLAY) {
+        *x = cursor_x;
+        *y = cursor_y;
+        return;
+    }
+    glfwGetCursorPos(window, x, y);
+    if (mode == REPLAY_RECORD) {
+        fprintf(file, "C,%.17g,%.17g\n", *x, *y);
+    }
+}
+
+int replay_get_exclusive(GLFWwindow *window) {
+    if (mode == REPLAY_PLAY) {
+        return exclusive == GLFW_CURSOR_DISABLED;
+    }
+    int result = glfwGetInputMode(window, GLFW_CURSOR);
+    if (mode == REPLAY_RECORD) {
+        fprintf(file, "X,%d\n", result);
+    }
+    return result == GLFW_CURSOR_DISABLED;
+}
+
+const char *replay_clipboard(GLFWwindow *window) {
+    if (mode == REPLAY_PLAY) {
+        return clipboard;
+    }
+    const char *result = glfwGetClipboardString(window);
+    if (!result) {
+        result = "";
+    }
+    if (mode == REPLAY_RECORD) {
+        fputs("V,", file);
+        write_escaped(result);
+        fputc('\n', file);
+    }
+    return result;
+}
+
+// Called by the input callbacks. Returns whether the event should be
+// handled: live input is ignored during playback.
+int replay_input(ReplayEvent *e) {
+    if (mode == REPLAY_PLAY) {
+        return dispatching;
+    }
+    if (mode == REPLAY_RECORD) {
+        switch (e->type) {
+            case REPLAY_KEY:
+                fprintf(file, "k,%d,%d,%d,%d\n", e->a, e->b, e->c, e->d);
+                break;
+            case REPLAY_CHAR:
+                fprintf(file, "c,%d\n", e->a);
+                break;
+            case REPLAY_BUTTON:
+                fprintf(file, "b,%d,%d,%d\n", e->a, e->b, e->c);
+                break;
+            case REPLAY_SCROLL:
+                fprintf(file, "s,%.17g,%.17g\n", e->x, e->y);
+                break;
+        }
+    }
+    return 1;
+}
+
+// Hands out the recorded events of the current frame in order.
+int replay_next_event(ReplayEvent *event) {
+    if (mode != REPLAY_PLAY || event_index == event_count) {
+        dispatching = 0;
+        return 0;
+    }
+    *event = events[event_index++];
+    dispatching = 1;
+    return 1;
+}
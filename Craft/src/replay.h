@@ -0,0 +1,40 @@
+#ifndef _replay_h_
+#define _replay_h_
+
+#include <GLFW/glfw3.h>
+
+#define REPLAY_OFF 0
+#define REPLAY_RECORD 1
+#define REPLAY_PLAY 2
+
+#define REPLAY_KEY 0
+#define REPLAY_CHAR 1
+#define REPLAY_BUTTON 2
+#define REPLAY_SCROLL 3
+
+typedef struct {
+    int type;
+    int a;
+    int b;
+    int c;
+    int d;
+    double x;
+    double y;
+} ReplayEvent;
+
+int replay_record(const char *path, unsigned int seed);
+int replay_play(const char *path, unsigned int *seed);
+void replay_close();
+int replay_mode();
+void replay_window(int *width, int *height);
+void replay_state(float *x, float *y, float *z, float *rx, float *ry);
+int replay_frame();
+double replay_time();
+int replay_get_key(GLFWwindow *window, int key);
+void replay_get_cursor(GLFWwindow *window, double *x, double *y);
+int replay_get_exclusive(GLFWwindow *window);
+const char *replay_clipboard(GLFWwindow *window);
+int replay_input(ReplayEvent *event);
+int replay_next_event(ReplayEvent *event);
+
+#endif
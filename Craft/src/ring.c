@@ -77,6 +77,20 @@ void ring_put_light(Ring *ring, int p, int q, int x, int y, int z, int w) {
     ring_put(ring, &entry);
 }
 
+// data holds x, y, z, w for count blocks or lights and is owned by the
+// entry from here on.
+void ring_put_blocks(
+    Ring *ring, RingEntryType type, int p, int q, int *data, int count)
+{
+    RingEntry entry;
+    entry.type = type;
+    entry.p = p;
+    entry.q = q;
+    entry.count = count;
+    entry.data = data;
+    ring_put(ring, &entry);
+}
+
 void ring_put_key(Ring *ring, int p, int q, int key) {
     RingEntry entry;
     entry.type = KEY;
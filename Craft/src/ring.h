@@ -4,6 +4,8 @@
 typedef enum {
     BLOCK,
     LIGHT,
+    BLOCKS,
+    LIGHTS,
     KEY,
     COMMIT,
     EXIT
@@ -18,6 +20,8 @@ typedef struct {
     int z;
     int w;
     int key;
+    int count;
+    int *data;
 } RingEntry;
 
 typedef struct {
@@ -36,6 +40,8 @@ void ring_grow(Ring *ring);
 void ring_put(Ring *ring, RingEntry *entry);
 void ring_put_block(Ring *ring, int p, int q, int x, int y, int z, int w);
 void ring_put_light(Ring *ring, int p, int q, int x, int y, int z, int w);
+void ring_put_blocks(
+    Ring *ring, RingEntryType type, int p, int q, int *data, int count);
 void ring_put_key(Ring *ring, int p, int q, int key);
 void ring_put_commit(Ring *ring);
 void ring_put_exit(Ring *ring);
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "lodepng.h"
+#include "packet.h"
+#include "snapshot.h"
+#include "util.h"
+
+// A snapshot is everything the server has stored for one chunk in a
+// single zlib stream. Blocks and lights are runs over the cells of the
+// chunk and its one block border, ordered by y, then z, then x: the
+// number of cells skipped, the run length and the value. The signs
+// follow with coordinates relative to the chunk. Decoding turns the runs
+// into x, y, z, w quadruples that the main thread applies in one go.
+
+#define SNAPSHOT_WIDTH (CHUNK_SIZE + 2)
+#define SNAPSHOT_HEIGHT 256
+#define SNAPSHOT_CELLS (SNAPSHOT_WIDTH * SNAPSHOT_WIDTH * SNAPSHOT_HEIGHT)
+#define MAX_SNAPSHOT_SIZE (16 << 20)
+
+Snapshot *snapshot_create(
+    int p, int q, int key, int size, const char *data, int length)
+{
+    Snapshot *snapshot = calloc(1, sizeof(Snapshot));
+    snapshot->p = p;
+    snapshot->q = q;
+    snapshot->key = key;
+    snapshot->state = SNAPSHOT_QUEUED;
+    snapshot->size = size;
+    snapshot->length = length;
+    snapshot->data = malloc(length);
+    memcpy(snapshot->data, data, length);
+    sign_list_alloc(&snapshot->signs, 4);
+    return snapshot;
+}
+
+void snapshot_free(Snapshot *snapshot) {
+    free(snapshot->data);
+    free(snapshot->blocks);
+    free(snapshot->lights);
+    sign_list_free(&snapshot->signs);
+    free(snapshot);
+}
+
+static int *decode_runs(Snapshot *snapshot, Packet *packet, int *count) {
+    int run_count = packet_uint(packet);
+    int capacity = 0;
+    int *result = 0;
+    *count = 0;
+    unsigned int index = 0;
+    for (int i = 0; i < run_count && !packet->error; i++) {
+        unsigned int skip = packet_uint(packet);
+        unsigned int length = packet_uint(packet);
+        int w = packet_int(packet);
+        if (skip > SNAPSHOT_CELLS - index ||
+            length > SNAPSHOT_CELLS - index - skip)
+        {
+            packet->error = 1;
+            break;
+        }
+        index += skip;
+        if (*count + (int)length > capacity) {
+            capacity = MAX(capacity * 2, *count + (int)length);
+            result = realloc(result, sizeof(int) * 4 * capacity);
+        }
+        for (unsigned int j = 0; j < length; j++, index++) {
+            int *b = result + (*count)++ * 4;
+            b[0] = snapshot->p * CHUNK_SIZE - 1 + index % SNAPSHOT_WIDTH;
+            b[1] = index / (SNAPSHOT_WIDTH * SNAPSHOT_WIDTH);
+            b[2] = snapshot->q * CHUNK_SIZE - 1 +
+                index / SNAPSHOT_WIDTH % SNAPSHOT_WIDTH;
+            b[3] = w;
+        }
+    }
+    return result;
+}
+
+// Runs on a worker thread. Sets error if the data is corrupt.
+void snapshot_decode(Snapshot *snapshot) {
+    unsigned char *raw = 0;
+    size_t raw_size = 0;
+    if (snapshot->size <= 0 || snapshot->size > MAX_SNAPSHOT_SIZE ||
+        lodepng_zlib_decompress(&raw, &raw_size,
+            snapshot->data, snapshot->length,
+            &lodepng_default_decompress_settings) ||
+        raw_size != (size_t)snapshot->size)
+    {
+        free(raw);
+        snapshot->error = 1;
+        return;
+    }
+    free(snapshot->data);
+    snapshot->data = 0;
+    Packet packet;
+    packet_init(&packet, (char *)raw, raw_size);
+    snapshot->blocks = decode_runs(snapshot, &packet, &snapshot->block_count);
+    snapshot->lights = decode_runs(snapshot, &packet, &snapshot->light_count);
+    int sign_count = packet_uint(&packet);
+    for (int i = 0; i < sign_count && !packet.error; i++) {
+        char text[MAX_SIGN_LENGTH];
+        int x = snapshot->p * CHUNK_SIZE + packet_int(&packet);
+        int y = packet_int(&packet);
+        int z = snapshot->q * CHUNK_SIZE + packet_int(&packet);
+        int face = packet_uint(&packet);
+        packet_string(&packet, text, MAX_SIGN_LENGTH);
+        if (!packet.error) {
+            sign_list_add(&snapshot->signs, x, y, z, face, text);
+        }
+    }
+    snapshot->error = packet.error;
+    free(raw);
+}
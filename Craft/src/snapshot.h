@@ -0,0 +1,32 @@
+#ifndef _snapshot_h_
+#define _snapshot_h_
+
+#include "sign.h"
+
+#define SNAPSHOT_QUEUED 0
+#define SNAPSHOT_BUSY 1
+#define SNAPSHOT_DONE 2
+#define SNAPSHOT_DROPPED 3
+
+typedef struct {
+    int p;
+    int q;
+    int key;
+    int state;
+    int error;
+    int size;
+    int length;
+    unsigned char *data;
+    int *blocks;
+    int block_count;
+    int *lights;
+    int light_count;
+    SignList signs;
+} Snapshot;
+
+Snapshot *snapshot_create(
+    int p, int q, int key, int size, const char *data, int length);
+void snapshot_free(Snapshot *snapshot);
+void snapshot_decode(Snapshot *snapshot);
+
+#endif
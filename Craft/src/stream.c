@@ -0,0 +1,52 @@
+#include <string.h>
+#include "stream.h"
+
+// writes are kept 16 byte aligned so any vertex format can start anywhere
+#define STREAM_ALIGN(n) (((n) + 15) & ~15)
+
+void stream_alloc(Stream *stream, int size) {
+    stream->size = size;
+    stream->offset = 0;
+    glGenBuffers(1, &stream->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void stream_free(Stream *stream) {
+    glDeleteBuffers(1, &stream->buffer);
+    memset(stream, 0, sizeof(Stream));
+}
+
+// Appends size bytes and returns their byte offset in stream->buffer. When
+// the buffer is full its storage is orphaned and writing restarts at the
+// front, so ranges the GPU may still be reading are never overwritten and
+// the writes can skip synchronization.
+int stream_write(Stream *stream, int size, const GLfloat *data) {
+    glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+    if (stream->offset + size > stream->size) {
+        while (stream->size < size) {
+            stream->size *= 2;
+        }
+        glBufferData(GL_ARRAY_BUFFER, stream->size, NULL, GL_STREAM_DRAW);
+        stream->offset = 0;
+    }
+    int offset = stream->offset;
+    void *dst = 0;
+    if (GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range) {
+        dst = glMapBufferRange(
+            GL_ARRAY_BUFFER, offset, size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+    if (dst) {
+        memcpy(dst, data, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    else {
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    stream->offset = STREAM_ALIGN(offset + size);
+    return offset;
+}
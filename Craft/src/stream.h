@@ -0,0 +1,16 @@
+#ifndef _stream_h_
+#define _stream_h_
+
+#include <GL/glew.h>
+
+typedef struct {
+    GLuint buffer;
+    int size;
+    int offset;
+} Stream;
+
+void stream_alloc(Stream *stream, int size);
+void stream_free(Stream *stream);
+int stream_write(Stream *stream, int size, const GLfloat *data);
+
+#endif
@@ -0,0 +1,159 @@
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tinycthread.h"
+#include "trace.h"
+
+#define MAX_TRACE_THREADS 32
+#define TRACE_EVENTS 262144
+
+typedef struct {
+    const char *name;
+    double time;
+    char phase;
+} TraceEvent;
+
+// Each thread appends to its own buffer, so recording takes no locks. The
+// count is published with a release store and read with an acquire load
+// when the trace is written out.
+typedef struct {
+    int tid;
+    int session;
+    int count;
+    char name[32];
+    TraceEvent *events;
+} TraceBuffer;
+
+static TraceBuffer buffers[MAX_TRACE_THREADS];
+static int buffer_count = 0;
+static mtx_t buffer_mtx;
+static int enabled = 0;
+static int session = 0;
+static double origin = 0;
+static _Thread_local TraceBuffer *local = 0;
+static _Thread_local char local_name[32];
+
+void trace_init() {
+    mtx_init(&buffer_mtx, mtx_plain);
+}
+
+// Call once every thread that recorded events has stopped; their buffers
+// are freed here.
+void trace_free() {
+    __atomic_store_n(&enabled, 0, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < buffer_count; i++) {
+        free(buffers[i].events);
+    }
+    buffer_count = 0;
+    mtx_destroy(&buffer_mtx);
+}
+
+int trace_active() {
+    return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+void trace_start() {
+    origin = glfwGetTime();
+    // buffers notice the new session on their next event and rewind
+    __atomic_add_fetch(&session, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&enabled, 1, __ATOMIC_SEQ_CST);
+}
+
+// names the calling thread in the trace output
+void trace_thread(const char *name) {
+    snprintf(local_name, sizeof(local_name), "%s", name);
+    if (local) {
+        snprintf(local->name, sizeof(local->name), "%s", name);
+    }
+}
+
+static TraceBuffer *trace_buffer() {
+    if (!local) {
+        mtx_lock(&buffer_mtx);
+        if (buffer_count < MAX_TRACE_THREADS) {
+            TraceBuffer *buffer = buffers + buffer_count;
+            buffer->tid = buffer_count + 1;
+            buffer->session = 0;
+            buffer->count = 0;
+            snprintf(buffer->name, sizeof(buffer->name), "%s",
+                local_name[0] ? local_name : "thread");
+            buffer->events = malloc(sizeof(TraceEvent) * TRACE_EVENTS);
+            local = buffer;
+            __atomic_store_n(&buffer_count, buffer_count + 1,
+                __ATOMIC_RELEASE);
+        }
+        mtx_unlock(&buffer_mtx);
+    }
+    return local;
+}
+
+static void trace_event(const char *name, char phase) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+    TraceBuffer *buffer = trace_buffer();
+    if (!buffer) {
+        return;
+    }
+    int current = __atomic_load_n(&session, __ATOMIC_ACQUIRE);
+    int count = buffer->count;
+    if (__atomic_load_n(&buffer->session, __ATOMIC_RELAXED) != current) {
+        __atomic_store_n(&buffer->session, current, __ATOMIC_RELEASE);
+        count = 0;
+    }
+    if (count == TRACE_EVENTS) {
+        return;
+    }
+    TraceEvent *event = buffer->events + count;
+    event->name = name;
+    event->time = glfwGetTime();
+    event->phase = phase;
+    __atomic_store_n(&buffer->count, count + 1, __ATOMIC_RELEASE);
+}
+
+// names must be string literals, only the pointer is recorded
+void trace_begin(const char *name) {
+    trace_event(name, 'B');
+}
+
+void trace_end(const char *name) {
+    trace_event(name, 'E');
+}
+
+// Stops recording and writes the events in the Chrome trace event format.
+// Returns the number of events written or -1 if the file can't be opened.
+int trace_stop(const char *path) {
+    __atomic_store_n(&enabled, 0, __ATOMIC_SEQ_CST);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+    int current = __atomic_load_n(&session, __ATOMIC_ACQUIRE);
+    int threads = __atomic_load_n(&buffer_count, __ATOMIC_ACQUIRE);
+    int written = 0;
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (int i = 0; i < threads; i++) {
+        TraceBuffer *buffer = buffers + i;
+        fprintf(file,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            i ? ",\n" : "", buffer->tid, buffer->name);
+        int count = __atomic_load_n(&buffer->count, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&buffer->session, __ATOMIC_ACQUIRE) != current) {
+            continue;
+        }
+        for (int j = 0; j < count; j++) {
+            TraceEvent *event = buffer->events + j;
+            fprintf(file,
+                ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.1f,"
+                "\"pid\":1,\"tid\":%d}",
+                event->name, event->phase,
+                (event->time - origin) * 1e6, buffer->tid);
+            written++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return written;
+}
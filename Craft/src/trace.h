@@ -0,0 +1,13 @@
+#ifndef _trace_h_
+#define _trace_h_
+
+void trace_init();
+void trace_free();
+int trace_active();
+void trace_start();
+int trace_stop(const char *path);
+void trace_thread(const char *name);
+void trace_begin(const char *name);
+void trace_end(const char *name);
+
+#endif
@@ -166,6 +166,90 @@ char *tokenize(char *str, const char *delim, char **key) {
     return result;
 }
 
+// Protocol field parsers, much cheaper than sscanf. Each reads one
+// comma separated field, skips the comma and returns the next field, or
+// returns 0 if the field is not a number.
+char *parse_int(char *str, int *value) {
+    char *p = str;
+    int sign = 1;
+    if (*p == '-') {
+        sign = -1;
+        p++;
+    }
+    if (*p < '0' || *p > '9') {
+        return 0;
+    }
+    int result = 0;
+    while (*p >= '0' && *p <= '9') {
+        result = result * 10 + (*p++ - '0');
+    }
+    if (*p == ',') {
+        p++;
+    }
+    *value = sign * result;
+    return p;
+}
+
+char *parse_double(char *str, double *value) {
+    char *p = str;
+    double sign = 1;
+    if (*p == '-') {
+        sign = -1;
+        p++;
+    }
+    int digits = 0;
+    double result = 0;
+    while (*p >= '0' && *p <= '9') {
+        result = result * 10 + (*p++ - '0');
+        digits++;
+    }
+    if (*p == '.') {
+        p++;
+        double scale = 0.1;
+        while (*p >= '0' && *p <= '9') {
+            result += (*p++ - '0') * scale;
+            scale *= 0.1;
+            digits++;
+        }
+    }
+    if (!digits || *p == 'e' || *p == 'E') {
+        // exponents, inf and nan are rare, leave them to the library
+        result = strtod(str, &p);
+        if (p == str) {
+            return 0;
+        }
+        sign = 1;
+    }
+    if (*p == ',') {
+        p++;
+    }
+    *value = sign * result;
+    return p;
+}
+
+char *parse_float(char *str, float *value) {
+    double result;
+    char *p = parse_double(str, &result);
+    if (p) {
+        *value = result;
+    }
+    return p;
+}
+
+char *parse_ints(char *str, int *values, int count) {
+    for (int i = 0; str && i < count; i++) {
+        str = parse_int(str, values + i);
+    }
+    return str;
+}
+
+char *parse_floats(char *str, float *values, int count) {
+    for (int i = 0; str && i < count; i++) {
+        str = parse_float(str, values + i);
+    }
+    return str;
+}
+
 int char_width(char input) {
     static const int lookup[128] = {
         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -39,6 +39,11 @@ GLuint make_program(GLuint shader1, GLuint shader2);
 GLuint load_program(const char *path1, const char *path2);
 void load_png_texture(const char *file_name);
 char *tokenize(char *str, const char *delim, char **key);
+char *parse_int(char *str, int *value);
+char *parse_double(char *str, double *value);
+char *parse_float(char *str, float *value);
+char *parse_ints(char *str, int *values, int count);
+char *parse_floats(char *str, float *values, int count);
 int char_width(char input);
 int string_width(const char *input);
 int wrap(const char *input, int max_width, char *output, int max_length);
@@ -4,5 +4,6 @@
 typedef void (*world_func)(int, int, int, int, void *);
 
 void create_world(int p, int q, world_func func, void *arg);
+void create_terrain(int p, int q, int flat, world_func func, void *arg);
 
 #endif